@@ -2,12 +2,12 @@
 
 #include "obs_scene_tree_view/version.h"
 
-#include <QLineEdit>
 #include <QAction>
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QListWidget>
 #include <QtWidgets/QMainWindow>
 #include <QtWidgets/QMenu>
+#include <QtWidgets/QMessageBox>
 #include <QtWidgets/QSpinBox>
 #include <QtWidgets/QWidgetAction>
 
@@ -15,6 +15,11 @@
 #include <util/platform.h>
 #include <obs-frontend-api.h>
 
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
 
 OBS_DECLARE_MODULE();
 OBS_MODULE_AUTHOR("DigitOtter");
@@ -130,6 +135,21 @@ ObsSceneTreeView::ObsSceneTreeView(QMainWindow *main_window)
 	config_t *const global_config = obs_frontend_get_user_config();
 	config_set_default_bool(global_config, "SceneTreeView", "ShowSceneIcons", false);
 	config_set_default_bool(global_config, "SceneTreeView", "ShowFolderIcons", false);
+	config_set_default_int(global_config, "SceneTreeView", "SaveDelayMs", SCENE_TREE_SAVE_DELAY_MS);
+	config_set_default_bool(global_config, "SceneTreeView", "JournalMode", false);
+	config_set_default_bool(global_config, "SceneTreeView", "BinaryFormat", false);
+	config_set_default_bool(global_config, "SceneTreeView", "DeferredActivation", false);
+	config_set_default_int(global_config, "SceneTreeView", "ActivationDelayMs", SCENE_ACTIVATION_DELAY_MS);
+
+	this->_tree_storage.Open();
+
+	const bool journal_mode = config_get_bool(global_config, "SceneTreeView", "JournalMode");
+	this->_tree_storage.SetJournalEnabled(journal_mode);
+	this->_scene_tree_items.SetRecordEdits(journal_mode);
+	this->_tree_storage.SetBinaryFormat(config_get_bool(global_config, "SceneTreeView", "BinaryFormat"));
+
+	// Parse the saved tree while OBS loads, so that only the model has to be filled once loading finished
+	this->_tree_storage.PreloadTree(BPtr<char>(obs_frontend_get_current_scene_collection()));
 
 	assert(this->_add_scene_act);
 	assert(this->_remove_scene_act);
@@ -161,12 +181,17 @@ ObsSceneTreeView::ObsSceneTreeView(QMainWindow *main_window)
 
 	this->_stv_dock.stvTree->SetItemModel(&this->_scene_tree_items);
 	this->_stv_dock.stvTree->setDefaultDropAction(Qt::DropAction::MoveAction);
+	this->_stv_dock.stvTree->SetDeferredActivation(config_get_bool(global_config, "SceneTreeView", "DeferredActivation"),
+	                                               (int)config_get_int(global_config, "SceneTreeView", "ActivationDelayMs"));
 
 	// Install model into the view and then wire selection changes to keep Move Up/Down enabled state fresh
 	this->_stv_dock.stvTree->setModel(&(this->_scene_tree_items));
 	if (auto sm = this->_stv_dock.stvTree->selectionModel()) {
 		QObject::connect(sm, &QItemSelectionModel::currentChanged, this,
-				[this](const QModelIndex &, const QModelIndex &) { this->UpdateMoveButtonsEnabled(); });
+				[this](const QModelIndex &current, const QModelIndex &) {
+					this->_scene_tree_items.SetCurrentIndex(current);
+					this->UpdateMoveButtonsEnabled();
+				});
 		QObject::connect(sm, &QItemSelectionModel::selectionChanged, this,
 				[this](const QItemSelection &, const QItemSelection &) { this->UpdateMoveButtonsEnabled(); });
 	}
@@ -174,6 +199,19 @@ ObsSceneTreeView::ObsSceneTreeView(QMainWindow *main_window)
 	const bool show_icons = config_get_bool(global_config, "BasicWindow", "ShowListboxToolbars");
 	this->on_toggleListboxToolbars(show_icons);
 
+	// Save tree after scenes were added, removed or renamed, or folders were expanded or collapsed
+	QObject::connect(&this->_scene_tree_items, &StvItemModel::SceneTreeChanged, this, &ObsSceneTreeView::MarkSceneTreeDirty);
+	QObject::connect(&this->_scene_tree_items, &StvItemModel::TreeEdited, this, &ObsSceneTreeView::AppendTreeEdit);
+
+	// Bursts of changes are written once, after the tree stopped changing
+	this->_save_timer.setSingleShot(true);
+	this->_save_timer.setInterval(std::max<int>(0, (int)config_get_int(global_config, "SceneTreeView", "SaveDelayMs")));
+	QObject::connect(&this->_save_timer, &QTimer::timeout, this, &ObsSceneTreeView::FlushSceneTree);
+
+	this->_scene_list_check_timer.setSingleShot(true);
+	this->_scene_list_check_timer.setInterval(SCENE_LIST_CHECK_DELAY_MS);
+	QObject::connect(&this->_scene_list_check_timer, &QTimer::timeout, this, &ObsSceneTreeView::CheckSceneList);
+
 	// Add callback to obs scene list change event
 	obs_frontend_add_event_callback(&ObsSceneTreeView::obs_frontend_event_cb, this);
 	obs_frontend_add_save_callback(&ObsSceneTreeView::obs_frontend_save_cb, this);
@@ -210,26 +248,89 @@ void ObsSceneTreeView::SaveSceneTree(const char *scene_collection)
 	if(!scene_collection)
 		return;
 
-	BPtr<char> stv_config_file_path = obs_module_config_path(SCENE_TREE_CONFIG_FILE.data());
+	// Only the tree of this collection is written. It is encoded and written in the background
+	StvTreeSnapshot snapshot;
+	this->_scene_tree_items.CaptureSceneTree(snapshot);
 
-	OBSDataAutoRelease stv_data = obs_data_create_from_json_file(stv_config_file_path);
-	if(!stv_data)
-		stv_data = obs_data_create();
+	this->_tree_storage.SaveTree(scene_collection, std::move(snapshot));
+}
 
-	this->_scene_tree_items.SaveSceneTree(stv_data, scene_collection, this->_stv_dock.stvTree);
+void ObsSceneTreeView::MarkSceneTreeDirty()
+{
+	// Journaled edits are already saved
+	if(this->_tree_storage.IsJournalEnabled() && !this->_scene_tree_dirty)
+		return;
+
+	this->_scene_tree_dirty = true;
+	this->_save_timer.start();
+}
+
+void ObsSceneTreeView::FlushSceneTree()
+{
+	this->_save_timer.stop();
+	this->_scene_tree_dirty = false;
 
-	if(!obs_data_save_json(stv_data, stv_config_file_path))
-		blog(LOG_WARNING, "[%s] Failed to save scene tree in '%s'", obs_module_name(), stv_config_file_path.Get());
+	this->SaveSceneTree(this->_scene_collection_name);
+}
+
+void ObsSceneTreeView::AppendTreeEdit(const OBSData &operation)
+{
+	// Fold the journal into the tree file off the edit path, with the debounced save
+	if(!this->_tree_storage.AppendJournal(this->_scene_collection_name, operation) ||
+	        this->_tree_storage.NeedsCompaction(this->_scene_collection_name))
+	{
+		this->_scene_tree_dirty = true;
+		this->MarkSceneTreeDirty();
+	}
 }
 
 void ObsSceneTreeView::LoadSceneTree(const char *scene_collection)
 {
 	assert(scene_collection);
 
-	BPtr<char> stv_config_file_path = obs_module_config_path(SCENE_TREE_CONFIG_FILE.data());
+	// Images are read in place, unless edits were journaled after they were saved
+	StvTreeImage tree_image;
+	if(this->_tree_storage.LoadTreeImage(scene_collection, tree_image))
+		this->_scene_tree_items.LoadSceneTree(tree_image);
+	else
+	{
+		OBSDataAutoRelease stv_data = this->_tree_storage.LoadTree(scene_collection);
+		this->_scene_tree_items.LoadSceneTree(stv_data, scene_collection);
+	}
+
+	// Outdated trees, e.g. of previous versions or with scenes that weren't loaded, are saved once before edits are
+	// journaled. Otherwise edits continue the journal of the loaded tree
+	if(this->_tree_storage.IsJournalEnabled())
+	{
+		if(this->_scene_tree_items.IsTreeOutdated() || !this->_tree_storage.ContinueJournal(scene_collection))
+			this->FlushSceneTree();
+	}
+	else if(this->_scene_tree_items.IsTreeOutdated())
+		this->MarkSceneTreeDirty();
+}
+
+void ObsSceneTreeView::CollectOrphanedTrees()
+{
+	std::unordered_set<std::string> scene_collections;
+
+	char **collection_names = obs_frontend_get_scene_collections();
+	for(char **name = collection_names; name && *name; ++name)
+		scene_collections.emplace(*name);
+
+	bfree(collection_names);
+
+	// An empty list means that OBS couldn't provide it, not that all collections were removed
+	if(scene_collections.empty())
+	{
+		blog(LOG_WARNING, "[%s] Scene collection list is empty, skipped removing orphaned scene trees", obs_module_name());
+		return;
+	}
+
+	// The list changes before a rename is announced, keep the tree of the current collection until it was moved
+	if(this->_scene_collection_name)
+		scene_collections.emplace(this->_scene_collection_name.Get());
 
-	OBSDataAutoRelease stv_data = obs_data_create_from_json_file(stv_config_file_path);
-	this->_scene_tree_items.LoadSceneTree(stv_data, scene_collection, this->_stv_dock.stvTree);
+	this->_tree_storage.CollectGarbage(scene_collections);
 }
 
 void ObsSceneTreeView::UpdateTreeView()
@@ -237,11 +338,33 @@ void ObsSceneTreeView::UpdateTreeView()
 	obs_frontend_source_list scene_list = {};
 	obs_frontend_get_scenes(&scene_list);
 
-	this->_scene_tree_items.UpdateTree(scene_list, this->_stv_dock.stvTree->currentIndex());
+	const uint64_t update_start_ns = os_gettime_ns();
+	const bool is_changed = this->_scene_tree_items.UpdateTree(scene_list, this->_stv_dock.stvTree->currentIndex());
+	const uint64_t update_ns = os_gettime_ns() - update_start_ns;
+
+	++this->_tree_update_count;
+	this->_tree_update_total_ns += update_ns;
+	this->_tree_update_max_ns = std::max(this->_tree_update_max_ns, update_ns);
+
+	blog(LOG_DEBUG, "[%s] Checked %zu scenes against the scene tree in %.3f ms", obs_module_name(), scene_list.sources.num,
+	     update_ns / 1000000.0);
 
 	obs_frontend_source_list_free(&scene_list);
 
-	this->SaveSceneTree(this->_scene_collection_name);
+	// A tree that matches the scene list was just loaded or saved
+	if(is_changed)
+		this->MarkSceneTreeDirty();
+}
+
+void ObsSceneTreeView::CheckSceneList()
+{
+	blog(LOG_DEBUG, "[%s] Checking scene tree after %zu scene list changes", obs_module_name(), this->_pending_scene_list_changes);
+
+	this->_scene_list_change_count += this->_pending_scene_list_changes;
+	++this->_scene_list_check_count;
+	this->_pending_scene_list_changes = 0;
+
+	this->UpdateTreeView();
 }
 
 void ObsSceneTreeView::on_toggleListboxToolbars(bool visible)
@@ -252,21 +375,22 @@ void ObsSceneTreeView::on_toggleListboxToolbars(bool visible)
 void ObsSceneTreeView::on_stvAddFolder_clicked()
 {
 	int row;
-	QStandardItem *selected = this->_scene_tree_items.itemFromIndex(this->_stv_dock.stvTree->currentIndex());
-	if(!selected)
-	{
-		selected = this->_scene_tree_items.invisibleRootItem();
-		row = selected->rowCount();
-	}
+	QModelIndex selected = this->_stv_dock.stvTree->currentIndex();
+	if(!selected.isValid())
+		row = this->_scene_tree_items.rowCount();
 	else
 	{
-		if(selected->type() == StvItemModel::FOLDER)
-			row = selected->rowCount();
+		if(this->_scene_tree_items.IsFolder(selected))
+		{
+			// Create the items of a folder that wasn't expanded yet, so that the new folder is appended to them
+			this->_scene_tree_items.fetchMore(selected);
+			row = this->_scene_tree_items.rowCount(selected);
+		}
 		else
 		{
-			row = selected->row()+1;
+			row = selected.row()+1;
 
-			selected = this->_scene_tree_items.GetParentOrRoot(selected->index());
+			selected = selected.parent();
 		}
 
 
@@ -277,25 +401,19 @@ void ObsSceneTreeView::on_stvAddFolder_clicked()
 	if (!format.contains("%1"))
 		format = QStringLiteral("Folder %1");
 	// Start numbering at 1 and choose the lowest available number (fills gaps)
-	int i = 1;
-	QString new_folder_name = format.arg(i);
-	while (!this->_scene_tree_items.CheckFolderNameUniqueness(new_folder_name, selected)) {
-		new_folder_name = format.arg(++i);
-	}
+	const QString new_folder_name = this->_scene_tree_items.CreateFolderName(format, selected);
 
-	StvFolderItem *pItem = new StvFolderItem(new_folder_name);
-	selected->insertRow(row, pItem);
+	this->_scene_tree_items.InsertFolder(selected, row, new_folder_name);
 
-	this->SaveSceneTree(this->_scene_collection_name);
+	this->MarkSceneTreeDirty();
 }
 
 void ObsSceneTreeView::on_stvRemove_released()
 {
-	QStandardItem *selected = this->_scene_tree_items.itemFromIndex(this->_stv_dock.stvTree->currentIndex());
-	if(selected)
+	const QModelIndex selected = this->_stv_dock.stvTree->currentIndex();
+	if(selected.isValid())
 	{
-		assert(selected->type() == StvItemModel::FOLDER || selected->type() == StvItemModel::SCENE);
-		if(selected->type() == StvItemModel::SCENE)
+		if(this->_scene_tree_items.IsScene(selected))
 			QMetaObject::invokeMethod(this->_remove_scene_act, "triggered");
 		else
 			this->RemoveFolder(selected);
@@ -308,7 +426,7 @@ void ObsSceneTreeView::on_stvRemove_released()
 
 void ObsSceneTreeView::on_stvTree_customContextMenuRequested(const QPoint &pos)
 {
-	QStandardItem *item = this->_scene_tree_items.itemFromIndex(this->_stv_dock.stvTree->indexAt(pos));
+	const QModelIndex item = this->_stv_dock.stvTree->indexAt(pos);
 
 	QMainWindow *main_window = reinterpret_cast<QMainWindow*>(obs_frontend_get_main_window());
 
@@ -321,9 +439,10 @@ void ObsSceneTreeView::on_stvTree_customContextMenuRequested(const QPoint &pos)
 	popup.addAction(obs_module_text("SceneTreeView.AddFolder"),
 	                this, SLOT(on_stvAddFolder_clicked()));
 
-	if(item)
+	if(item.isValid())
 	{
-		if(item->type() == StvItemModel::SCENE)
+		const StvItemModel::QITEM_TYPE item_type = this->_scene_tree_items.IsScene(item) ? StvItemModel::SCENE : StvItemModel::FOLDER;
+		if(item_type == StvItemModel::SCENE)
 		{
 			QAction *copyFilters = new QAction(QTStr("Copy.Filters"), this);
 			copyFilters->setEnabled(false);
@@ -412,25 +531,43 @@ void ObsSceneTreeView::on_stvTree_customContextMenuRequested(const QPoint &pos)
 		popup.addSeparator();
 
 		// Enable/disable scene or folder icon
-		const auto toggleName = item->type() == StvItemModel::SCENE ? obs_module_text("SceneTreeView.ToggleSceneIcons") :
-		                                                              obs_module_text("SceneTreeView.ToggleFolderIcons");
+		const auto toggleName = item_type == StvItemModel::SCENE ? obs_module_text("SceneTreeView.ToggleSceneIcons") :
+		                                                           obs_module_text("SceneTreeView.ToggleFolderIcons");
 
 		QAction *toggleIconAction = popup.addAction(toggleName);
 		toggleIconAction->setCheckable(true);
 
-		const auto configName = item->type() == StvItemModel::SCENE ? "ShowSceneIcons" : "ShowFolderIcons";
+		const auto configName = item_type == StvItemModel::SCENE ? "ShowSceneIcons" : "ShowFolderIcons";
 		const bool showIcon = config_get_bool(obs_frontend_get_user_config(), "SceneTreeView", configName);
 
 		toggleIconAction->setChecked(showIcon);
 
-		auto toggleIcon = [this, showIcon, configName, item]() {
+		auto toggleIcon = [this, showIcon, configName, item_type]() {
 			config_set_bool(obs_frontend_get_user_config(), "SceneTreeView", configName, !showIcon);
-			this->_scene_tree_items.SetIconVisibility(!showIcon, (StvItemModel::QITEM_TYPE)item->type());
+			this->_scene_tree_items.SetIconVisibility(!showIcon, item_type);
 		};
 
 		connect(toggleIconAction, &QAction::triggered, toggleIcon);
 	}
 
+	popup.addSeparator();
+
+	// Switch scenes only once keyboard navigation settled
+	QAction *deferredActivationAction = popup.addAction(obs_module_text("SceneTreeView.DeferredActivation"));
+	deferredActivationAction->setCheckable(true);
+
+	const bool deferredActivation = config_get_bool(obs_frontend_get_user_config(), "SceneTreeView", "DeferredActivation");
+	deferredActivationAction->setChecked(deferredActivation);
+
+	auto toggleDeferredActivation = [this, deferredActivation]() {
+		config_t *const global_config = obs_frontend_get_user_config();
+		config_set_bool(global_config, "SceneTreeView", "DeferredActivation", !deferredActivation);
+		this->_stv_dock.stvTree->SetDeferredActivation(!deferredActivation,
+		                                               (int)config_get_int(global_config, "SceneTreeView", "ActivationDelayMs"));
+	};
+
+	connect(deferredActivationAction, &QAction::triggered, toggleDeferredActivation);
+
 //	popup.addSeparator();
 
 //	bool grid = ui->scenes->GetGridMode();
@@ -447,60 +584,175 @@ void ObsSceneTreeView::on_stvTree_customContextMenuRequested(const QPoint &pos)
 
 void ObsSceneTreeView::on_SceneNameEdited(QWidget *editor)
 {
-	QStandardItem *selected = this->_scene_tree_items.itemFromIndex(this->_stv_dock.stvTree->currentIndex());
-	if(selected->type() == StvItemModel::SCENE)
+	const QModelIndex selected = this->_stv_dock.stvTree->currentIndex();
+	if(this->_scene_tree_items.IsScene(selected))
 	{
 		QMainWindow *main_window = reinterpret_cast<QMainWindow*>(obs_frontend_get_main_window());
 		QMetaObject::invokeMethod(main_window, "SceneNameEdited", Q_ARG(QWidget*, editor));
 	}
 	else
 	{
-		QLineEdit *edit = qobject_cast<QLineEdit *>(editor);
-		std::string text = QT_TO_UTF8(edit->text().trimmed());
+		// The delegate already set the name, the model made it unique
+		this->MarkSceneTreeDirty();
+	}
+}
 
-		selected->setText(this->_scene_tree_items.CreateUniqueFolderName(selected,
-		                                                                 this->_scene_tree_items.GetParentOrRoot(selected->index())));
+void ObsSceneTreeView::SelectCurrentScene(uint64_t event_ns)
+{
+	const QModelIndex scene_index = this->_scene_tree_items.GetCurrentSceneIndex();
+	if(!scene_index.isValid() || scene_index == this->_stv_dock.stvTree->currentIndex())
+	{
+		this->RecordSceneSelectLatency(os_gettime_ns() - event_ns);
+		return;
 	}
+
+	const QPersistentModelIndex index = scene_index;
+	QMetaObject::invokeMethod(this, [this, index, event_ns]() {
+		if(index.isValid())
+			this->_stv_dock.stvTree->SelectSceneItem(index);
+
+		this->RecordSceneSelectLatency(os_gettime_ns() - event_ns);
+	}, Qt::QueuedConnection);
 }
 
-void ObsSceneTreeView::SelectCurrentScene()
+void ObsSceneTreeView::RecordSceneSelectLatency(uint64_t latency_ns)
 {
-	QStandardItem *item = this->_scene_tree_items.GetCurrentSceneItem();
-	if(item && item->index() != this->_stv_dock.stvTree->currentIndex())
-		QMetaObject::invokeMethod(this->_stv_dock.stvTree, "setCurrentIndex", Q_ARG(QModelIndex, item->index()));
+	const auto &bounds = SCENE_SELECT_LATENCY_BOUNDS_US;
+	const size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), latency_ns / 1000) - bounds.begin();
+	++this->_scene_select_latencies[bucket];
 }
 
-void ObsSceneTreeView::RemoveFolder(QStandardItem *folder)
+void ObsSceneTreeView::LogSceneSelectLatencies() const
 {
-	int row = 0;
-	int row_count = folder->rowCount();
-	while(row < row_count)
+	std::string histogram;
+	for(size_t i = 0; i < this->_scene_select_latencies.size(); ++i)
 	{
-		QStandardItem *item = folder->child(row);
-		assert(item->type() == StvItemModel::FOLDER || item->type() == StvItemModel::SCENE);
+		histogram += i < SCENE_SELECT_LATENCY_BOUNDS_US.size() ? " <=" + std::to_string(SCENE_SELECT_LATENCY_BOUNDS_US[i]) + "us: "
+		                                                       : " >" + std::to_string(SCENE_SELECT_LATENCY_BOUNDS_US.back()) + "us: ";
+		histogram += std::to_string(this->_scene_select_latencies[i]);
+	}
 
-		if(item->type() == StvItemModel::SCENE)
-		{
-			// Keep source reference to prevent race conditions on deletion via "triggered action"
-			obs_weak_source_t *weak = item->data(StvItemModel::OBS_SCENE).value<obs_weak_source_ptr>().ptr;
-			OBSSourceAutoRelease source = OBSGetStrongRef(weak);
+	blog(LOG_INFO, "[%s] Scene selection latency:%s", obs_module_name(), histogram.c_str());
+}
 
-			this->_scene_tree_items.SetSelectedScene(item, obs_frontend_preview_program_mode_active());
-			QMetaObject::invokeMethod(this->_remove_scene_act, "triggered");
+void ObsSceneTreeView::RemoveFolder(const QModelIndex &folder)
+{
+	// Keep source references, so that the scenes stay valid until they're removed
+	std::vector<OBSSource> scenes;
+	this->CollectFolderScenes(folder, scenes);
+
+	// A scene collection keeps at least one scene. The kept scene isn't counted as removed
+	QString kept_scene_name;
+	if(!scenes.empty() && !this->FindRemainingScene(scenes))
+	{
+		kept_scene_name = QString::fromUtf8(obs_source_get_name(scenes.back()));
+		scenes.pop_back();
+	}
+
+	// Confirm once for the whole folder instead of once per scene
+	if(!scenes.empty())
+	{
+		QString text = QString::fromUtf8(obs_module_text("SceneTreeView.RemoveFolderScenes")).arg(folder.data().toString(), QString::number(scenes.size()));
+		if(!kept_scene_name.isEmpty())
+			text += "\n" + QString::fromUtf8(obs_module_text("SceneTreeView.KeepLastScene")).arg(kept_scene_name);
+
+		if(QMessageBox::question(this, QTStr("ConfirmRemove.Title"), text) != QMessageBox::Yes)
+			return;
+	}
+
+	const QPersistentModelIndex folder_index = folder;
+	this->RemoveScenes(scenes);
+
+	// The model removed the items of the removed scenes. Remove the folder if it doesn't contain a scene anymore
+	if(!folder_index.isValid())
+		return;
+
+	std::vector<OBSSource> remaining_scenes;
+	this->CollectFolderScenes(folder_index, remaining_scenes);
+
+	if(remaining_scenes.empty())
+	{
+		this->_scene_tree_items.removeRow(folder_index.row(), folder_index.parent());
+		this->MarkSceneTreeDirty();
+	}
+}
+
+void ObsSceneTreeView::CollectFolderScenes(const QModelIndex &folder, std::vector<OBSSource> &scenes)
+{
+	// Create items of a folder that wasn't expanded yet, so that its scenes are removed as well
+	this->_scene_tree_items.fetchMore(folder);
+
+	for(int row = 0; row < this->_scene_tree_items.rowCount(folder); ++row)
+	{
+		const QModelIndex item = this->_scene_tree_items.index(row, 0, folder);
+		if(this->_scene_tree_items.IsFolder(item))
+		{
+			this->CollectFolderScenes(item, scenes);
+			continue;
 		}
-		else
-			this->RemoveFolder(item);
 
-		// Check if item was deleted. If not, move to next row
-		if(row_count == folder->rowCount())
-			++row;
+		// Items of removed scenes may still exist until OBS handled the removal
+		OBSSource source = OBSGetStrongRef(this->_scene_tree_items.GetSceneSource(item));
+		if(source && !obs_source_removed(source))
+			scenes.push_back(std::move(source));
+	}
+}
+
+void ObsSceneTreeView::RemoveScenes(std::vector<OBSSource> &scenes)
+{
+	if(scenes.empty())
+		return;
+
+	// Switch to a remaining scene once, instead of OBS selecting the next scene after every removal
+	OBSSource remaining_scene = this->FindRemainingScene(scenes);
 
-		row_count = folder->rowCount();
+	// A scene collection keeps at least one scene
+	if(!remaining_scene)
+	{
+		remaining_scene = scenes.back();
+		scenes.pop_back();
 	}
 
-	// Remove folder if empty
-	if(folder->rowCount() == 0)
-		this->_scene_tree_items.GetParentOrRoot(folder->index())->removeRow(folder->row());
+	std::unordered_set<obs_source_t*> removed_scenes;
+	for(const auto &source : scenes)
+		removed_scenes.insert(source);
+
+	if(removed_scenes.count(OBSSourceAutoRelease(obs_frontend_get_current_scene()).Get()))
+		obs_frontend_set_current_scene(remaining_scene);
+
+	if(obs_frontend_preview_program_mode_active() && removed_scenes.count(OBSSourceAutoRelease(obs_frontend_get_current_preview_scene()).Get()))
+		obs_frontend_set_current_preview_scene(remaining_scene);
+
+	// The model removes the items of each scene from its source signals. The scene list is checked once afterwards
+	this->_is_removing_scenes = true;
+	for(const auto &source : scenes)
+		obs_source_remove(source);
+	this->_is_removing_scenes = false;
+
+	this->_scene_list_check_timer.stop();
+	this->CheckSceneList();
+
+	blog(LOG_INFO, "[%s] Removed %zu scenes", obs_module_name(), scenes.size());
+}
+
+OBSSource ObsSceneTreeView::FindRemainingScene(const std::vector<OBSSource> &scenes)
+{
+	std::unordered_set<obs_source_t*> removed_scenes;
+	for(const auto &source : scenes)
+		removed_scenes.insert(source);
+
+	OBSSource remaining_scene;
+	obs_frontend_source_list scene_list = {};
+	obs_frontend_get_scenes(&scene_list);
+	for(size_t i = 0; i < scene_list.sources.num && !remaining_scene; ++i)
+	{
+		if(!removed_scenes.count(scene_list.sources.array[i]))
+			remaining_scene = scene_list.sources.array[i];
+	}
+
+	obs_frontend_source_list_free(&scene_list);
+
+	return remaining_scene;
 }
 
 Q_DECLARE_METATYPE(OBSSource);
@@ -600,7 +852,7 @@ QMenu *ObsSceneTreeView::CreatePerSceneTransitionMenu(QMainWindow *main_window)
 	return menu;
 }
 
-void ObsSceneTreeView::ObsFrontendEvent(enum obs_frontend_event event)
+void ObsSceneTreeView::ObsFrontendEvent(enum obs_frontend_event event, uint64_t event_ns)
 {
 	// Update our tree view when scene list was changed
 
@@ -628,11 +880,17 @@ void ObsSceneTreeView::ObsFrontendEvent(enum obs_frontend_event event)
 
 		this->_scene_collection_name = obs_frontend_get_current_scene_collection();
 
+		// Theme icons are available once the main window finished loading
+		this->_scene_tree_items.UpdateIcons();
+
 		// Load saved scene locations, then add any missing items that weren't saved
 		this->LoadSceneTree(this->_scene_collection_name);
 		this->UpdateTreeView();
 
-		this->SelectCurrentScene();
+		this->SelectCurrentScene(event_ns);
+
+		// The list of scene collections is complete once OBS finished loading
+		this->CollectOrphanedTrees();
 
 		// Apply icons and theme classes; reusable for theme changes and initial load
 		auto applyThemeAndIcons = [this]() {
@@ -715,6 +973,7 @@ void ObsSceneTreeView::ObsFrontendEvent(enum obs_frontend_event event)
 		{
 			// Reapply icons and theme classes when user switches themes at runtime
 			QMainWindow *main_window = reinterpret_cast<QMainWindow*>(obs_frontend_get_main_window());
+			this->_scene_tree_items.UpdateIcons();
 			if (this->_add_scene_act)
 				this->_stv_dock.stvAdd->setIcon(this->_add_scene_act->icon());
 			if (this->_remove_scene_act)
@@ -770,37 +1029,84 @@ void ObsSceneTreeView::ObsFrontendEvent(enum obs_frontend_event event)
 		}
 
 	else if(event == OBS_FRONTEND_EVENT_SCENE_LIST_CHANGED)
-		this->UpdateTreeView();
+	{
+		// Changes were already applied via source signals, only schedule a consistency check. The check is
+		// pushed back while changes keep coming in, so that a burst of changes results in a single check
+		++this->_pending_scene_list_changes;
+		if(this->_is_removing_scenes)
+			return;
+
+		const uint64_t now_ns = os_gettime_ns();
+		if(!this->_scene_list_check_timer.isActive())
+			this->_scene_list_check_start_ns = now_ns;
+
+		// The check runs at most SCENE_LIST_CHECK_MAX_DELAY_MS after the first change of a burst
+		const int elapsed_ms = (int)std::min<uint64_t>((now_ns - this->_scene_list_check_start_ns) / 1000000, SCENE_LIST_CHECK_MAX_DELAY_MS);
+		this->_scene_list_check_timer.start(std::min(SCENE_LIST_CHECK_DELAY_MS, SCENE_LIST_CHECK_MAX_DELAY_MS - elapsed_ms));
+	}
 	else if(event == OBS_FRONTEND_EVENT_SCENE_CHANGED || event == OBS_FRONTEND_EVENT_PREVIEW_SCENE_CHANGED)
-		this->SelectCurrentScene();
+		this->SelectCurrentScene(event_ns);
+	else if(event == OBS_FRONTEND_EVENT_PROFILE_CHANGED)
+		this->_scene_tree_items.UpdateSceneSize();
 	else if(event == OBS_FRONTEND_EVENT_SCENE_COLLECTION_CLEANUP)
 	{
+		// Write changes made after SCENE_COLLECTION_CHANGING before the tree is cleared
+		if(this->_scene_tree_dirty)
+			this->FlushSceneTree();
+
+		// The tree of the next collection is checked after it was loaded
+		this->_scene_list_check_timer.stop();
+		this->_pending_scene_list_changes = 0;
 		this->_scene_tree_items.CleanupSceneTree();
 		this->_scene_collection_name = nullptr;
 	}
 	else if(event == OBS_FRONTEND_EVENT_SCENE_COLLECTION_CHANGING)
-		this->SaveSceneTree(this->_scene_collection_name);
+	{
+		if(this->_scene_tree_dirty)
+			this->FlushSceneTree();
+	}
 	else if(event == OBS_FRONTEND_EVENT_SCENE_COLLECTION_CHANGED)
 	{
 		this->_scene_collection_name = obs_frontend_get_current_scene_collection();
 		this->LoadSceneTree(this->_scene_collection_name);
 		this->UpdateTreeView();
 	}
+	else if(event == OBS_FRONTEND_EVENT_SCENE_COLLECTION_LIST_CHANGED)
+		this->CollectOrphanedTrees();
 	else if(event == OBS_FRONTEND_EVENT_SCENE_COLLECTION_RENAMED)
 	{
-		// TODO: Delete old scene tree from json file
-
+		// Move the saved tree to the new name, then save it, so that the file contains the new name as well
+		const std::string previous_name = this->_scene_collection_name ? this->_scene_collection_name.Get() : "";
 		this->_scene_collection_name = obs_frontend_get_current_scene_collection();
-		this->SaveSceneTree(this->_scene_collection_name);
+		this->_tree_storage.RenameCollection(previous_name.c_str(), this->_scene_collection_name);
+
+		this->FlushSceneTree();
 
 		this->UpdateTreeView();
 	}
+	else if(event == OBS_FRONTEND_EVENT_EXIT)
+	{
+		if(this->_scene_tree_dirty)
+			this->FlushSceneTree();
+
+		this->_tree_storage.WaitForWrites();
+
+		blog(LOG_INFO, "[%s] Folded %zu scene list changes into %zu scene list checks", obs_module_name(),
+		     this->_scene_list_change_count, this->_scene_list_check_count);
+
+		if(this->_tree_update_count > 0)
+			blog(LOG_INFO, "[%s] Checked the scene tree %zu times, taking %.3f ms on average and %.3f ms at most", obs_module_name(),
+			     this->_tree_update_count, this->_tree_update_total_ns / 1000000.0 / this->_tree_update_count,
+			     this->_tree_update_max_ns / 1000000.0);
+		this->LogSceneSelectLatencies();
+	}
 }
 
 void ObsSceneTreeView::ObsFrontendSave(obs_data_t */*save_data*/, bool saving)
 {
-	if(saving)
-		this->SaveSceneTree(this->_scene_collection_name);
+	// Only write changes that are still pending. Journaled edits are already saved
+	if(saving && this->_scene_tree_dirty)
+		this->FlushSceneTree();
 }
 
 
@@ -810,11 +1116,11 @@ void ObsSceneTreeView::on_stvMoveUp_released()
 	if (!idx.isValid())
 		return;
 	const int oldRow = idx.row();
-	QStandardItem *parent = this->_scene_tree_items.GetParentOrRoot(idx);
+	const QModelIndex parent = idx.parent();
 	if (this->_scene_tree_items.MoveIndexByOne(idx, -1)) {
-		this->SaveSceneTree(this->_scene_collection_name);
-		if (parent && oldRow - 1 >= 0 && oldRow - 1 < parent->rowCount())
-			this->_stv_dock.stvTree->setCurrentIndex(parent->child(oldRow - 1)->index());
+		this->MarkSceneTreeDirty();
+		if (oldRow - 1 >= 0 && oldRow - 1 < this->_scene_tree_items.rowCount(parent))
+			this->_stv_dock.stvTree->setCurrentIndex(this->_scene_tree_items.index(oldRow - 1, 0, parent));
 	}
 	this->UpdateMoveButtonsEnabled();
 }
@@ -825,12 +1131,12 @@ void ObsSceneTreeView::on_stvMoveDown_released()
 	if (!idx.isValid())
 		return;
 	const int oldRow = idx.row();
-	QStandardItem *parent = this->_scene_tree_items.GetParentOrRoot(idx);
+	const QModelIndex parent = idx.parent();
 	if (this->_scene_tree_items.MoveIndexByOne(idx, +1)) {
-		this->SaveSceneTree(this->_scene_collection_name);
+		this->MarkSceneTreeDirty();
 		// With corrected move-down logic, moved item ends at oldRow + 1
-		if (parent && oldRow + 1 < parent->rowCount())
-			this->_stv_dock.stvTree->setCurrentIndex(parent->child(oldRow + 1)->index());
+		if (oldRow + 1 < this->_scene_tree_items.rowCount(parent))
+			this->_stv_dock.stvTree->setCurrentIndex(this->_scene_tree_items.index(oldRow + 1, 0, parent));
 	}
 	this->UpdateMoveButtonsEnabled();
 }
@@ -841,9 +1147,8 @@ void ObsSceneTreeView::UpdateMoveButtonsEnabled()
 	bool enableDown = false;
 	const QModelIndex idx = this->_stv_dock.stvTree->currentIndex();
 	if (idx.isValid()) {
-		QStandardItem *parent = this->_scene_tree_items.GetParentOrRoot(idx);
 		const int row = idx.row();
-		const int count = parent ? parent->rowCount() : 0;
+		const int count = this->_scene_tree_items.rowCount(idx.parent());
 		enableUp = (row > 0);
 		enableDown = (row >= 0 && row < count - 1);
 	}
@@ -1,15 +1,20 @@
 #ifndef OBS_SCENE_TREE_VIEW_H
 #define OBS_SCENE_TREE_VIEW_H
 
+#include <array>
 #include <map>
+#include <vector>
 
 #include <QAbstractItemDelegate>
+#include <QTimer>
 #include <QtWidgets/QDockWidget>
 
+#include <util/platform.h>
 #include <util/util.hpp>
 
 #include "obs-data.h"
 #include "obs_scene_tree_view/stv_item_model.h"
+#include "obs_scene_tree_view/stv_tree_storage.h"
 #include "ui_scene_tree_view.h"
 
 class ObsSceneTreeView
@@ -18,7 +23,20 @@ class ObsSceneTreeView
 		Q_OBJECT
 
 	public:
-		static constexpr std::string_view SCENE_TREE_CONFIG_FILE = "scene_tree.json";
+		// Scene changes are applied incrementally by the model. The full scene list is only compared against
+		// the tree as a consistency check, once OBS reported no further scene list change for this long
+		static constexpr int SCENE_LIST_CHECK_DELAY_MS = 1000;
+
+		// Continuous scene list changes delay the check at most this long
+		static constexpr int SCENE_LIST_CHECK_MAX_DELAY_MS = 5000;
+
+		// Tree changes are written after no further changes occurred for this long. Can be overridden with
+		// SceneTreeView/SaveDelayMs in the user config
+		static constexpr int SCENE_TREE_SAVE_DELAY_MS = 2000;
+
+		// With SceneTreeView/DeferredActivation set, scenes selected with the keyboard are switched to after the
+		// selection didn't change for this long. Can be overridden with SceneTreeView/ActivationDelayMs
+		static constexpr int SCENE_ACTIVATION_DELAY_MS = 300;
 
 		ObsSceneTreeView(QMainWindow *main_window);
 		virtual ~ObsSceneTreeView() override;
@@ -26,8 +44,16 @@ class ObsSceneTreeView
 		void SaveSceneTree(const char *scene_collection);
 		void LoadSceneTree(const char *scene_collection);
 
+		void MarkSceneTreeDirty();
+		void FlushSceneTree();
+
+		// With SceneTreeView/JournalMode set in the user config, edits are appended to a journal and the tree file
+		// is only rewritten once the journal grew too large
+		void AppendTreeEdit(const OBSData &operation);
+
 	protected slots:
 		void UpdateTreeView();
+		void CheckSceneList();
 
 		void on_toggleListboxToolbars(bool visible);
 
@@ -63,21 +89,57 @@ class ObsSceneTreeView
 		Ui::STVDock _stv_dock;
 
 		StvItemModel _scene_tree_items;
+		StvTreeStorage _tree_storage;
 		BPtr<char> _scene_collection_name = nullptr;
 
-		void SelectCurrentScene();
-		void RemoveFolder(QStandardItem *folder);
+		QTimer _scene_list_check_timer;
+		uint64_t _scene_list_check_start_ns = 0;
+
+		// Scene list changes folded into the pending check, and totals since startup
+		size_t _pending_scene_list_changes = 0;
+		size_t _scene_list_change_count = 0;
+		size_t _scene_list_check_count = 0;
+
+		// Time spent comparing the scene list against the tree's scene index
+		size_t _tree_update_count = 0;
+		uint64_t _tree_update_total_ns = 0;
+		uint64_t _tree_update_max_ns = 0;
+
+		// Scene list checks are held back while several scenes are removed at once
+		bool _is_removing_scenes = false;
+
+		// Time from a scene change reported by OBS until the view selected the scene, counted per bucket.
+		// The last bucket counts all latencies above the largest bound
+		static constexpr std::array<uint64_t, 7> SCENE_SELECT_LATENCY_BOUNDS_US = {100, 250, 500, 1000, 5000, 16000, 50000};
+		std::array<size_t, SCENE_SELECT_LATENCY_BOUNDS_US.size() + 1> _scene_select_latencies = {};
+
+		void RecordSceneSelectLatency(uint64_t latency_ns);
+		void LogSceneSelectLatencies() const;
+
+		QTimer _save_timer;
+		bool _scene_tree_dirty = false;
+
+		// event_ns is the time the frontend event that changed the scene was reported
+		void SelectCurrentScene(uint64_t event_ns);
+		void RemoveFolder(const QModelIndex &folder);
+		void CollectFolderScenes(const QModelIndex &folder, std::vector<OBSSource> &scenes);
+		void RemoveScenes(std::vector<OBSSource> &scenes);
+
+		// Returns a scene of the collection that isn't part of scenes, nullptr if all of them would be removed
+		static OBSSource FindRemainingScene(const std::vector<OBSSource> &scenes);
+		void CollectOrphanedTrees();
 
 		// Copied from OBS, OBSBasic::CreatePerSceneTransitionMenu()
 		QMenu *CreatePerSceneTransitionMenu(QMainWindow *main_window);
 
+		// Events are timestamped on arrival, so that latencies include the time until they're handled
 		inline static void obs_frontend_event_cb(enum obs_frontend_event event, void *private_data)
-		{	((ObsSceneTreeView*)private_data)->ObsFrontendEvent(event);	}
+		{	((ObsSceneTreeView*)private_data)->ObsFrontendEvent(event, os_gettime_ns());	}
 
 		inline static void obs_frontend_save_cb(obs_data_t *save_data, bool saving, void *private_data)
 		{	((ObsSceneTreeView*)private_data)->ObsFrontendSave(save_data, saving);	}
 
-		void ObsFrontendEvent(enum obs_frontend_event event);
+		void ObsFrontendEvent(enum obs_frontend_event event, uint64_t event_ns);
 		void ObsFrontendSave(obs_data_t *save_data, bool saving);
 };
 
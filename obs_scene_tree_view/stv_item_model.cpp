@@ -1,59 +1,232 @@
 #include "obs_scene_tree_view/stv_item_model.h"
 
+#include "obs_scene_tree_view/stv_tree_image.h"
+
 #include <util/config-file.h>
+#include <util/platform.h>
 
 #include <QMessageBox>
 #include <QLineEdit>
+#include <QDataStream>
 #include <QMimeData>
 #include <QRegularExpression>
 #include <QtWidgets/QMainWindow>
 
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+
 
-StvFolderItem::StvFolderItem(const QString &text)
-    : QStandardItem(text)
+bool StvFolderNames::IsIndexed() const
+{	return this->_is_indexed;	}
+
+void StvFolderNames::SetIndexed()
 {
-	this->setDropEnabled(true);
+	this->Clear();
+	this->_is_indexed = true;
+}
 
-	QMainWindow *main_window = reinterpret_cast<QMainWindow*>(obs_frontend_get_main_window());
-	QIcon icon = config_get_bool(obs_frontend_get_user_config(), "SceneTreeView", "ShowFolderIcons") ?
-	            main_window->property("groupIcon").value<QIcon>() :
-	            QIcon();
-	this->setIcon(icon);
+void StvFolderNames::Clear()
+{
+	this->_is_indexed = false;
+	this->_folders.clear();
+	this->_name_counts.clear();
+	this->_formats.clear();
 }
 
-int StvFolderItem::type() const
-{	return StvItemModel::FOLDER;	}
+bool StvFolderNames::IsUnique(const QString &name, uint32_t node_to_skip) const
+{
+	const auto count_it = this->_name_counts.find(name);
+	if(count_it == this->_name_counts.end())
+		return true;
+
+	int count = count_it->second;
+	if(const auto folder_it = this->_folders.find(node_to_skip); folder_it != this->_folders.end() && folder_it->second == name)
+		--count;
 
+	return count <= 0;
+}
 
-StvSceneItem::StvSceneItem(const QString &text, obs_weak_source_t *weak)
-    : QStandardItem(text)
+QString StvFolderNames::CreateUniqueName(const QString &format, uint32_t node_to_skip)
 {
-	this->setDropEnabled(false);
-	this->setData(QVariant::fromValue(obs_weak_source_ptr({weak})), StvItemModel::OBS_SCENE);
+	auto format_it = this->_formats.find(format);
+	if(format_it == this->_formats.end())
+	{
+		const qsizetype placeholder_pos = format.lastIndexOf("%1");
+		assert(placeholder_pos >= 0);
 
-	QMainWindow *main_window = reinterpret_cast<QMainWindow*>(obs_frontend_get_main_window());
-	QIcon icon = config_get_bool(obs_frontend_get_user_config(), "SceneTreeView", "ShowSceneIcons") ?
-	            main_window->property("sceneIcon").value<QIcon>() :
-	            QIcon();
-	this->setIcon(icon);
+		format_it = this->_formats.emplace(format, name_format_t{format.left(placeholder_pos), format.mid(placeholder_pos + 2), 1}).first;
+	}
+
+	name_format_t &name_format = format_it->second;
+
+	QString name = name_format.Prefix + QString::number(name_format.NextNumber) + name_format.Suffix;
+	while(!this->IsUnique(name, node_to_skip))
+		name = name_format.Prefix + QString::number(++name_format.NextNumber) + name_format.Suffix;
+
+	return name;
+}
+
+void StvFolderNames::AddFolder(uint32_t node, const QString &name)
+{
+	if(this->_folders.emplace(node, name).second)
+		this->AddName(name);
+}
+
+void StvFolderNames::RemoveFolder(uint32_t node)
+{
+	if(const auto folder_it = this->_folders.find(node); folder_it != this->_folders.end())
+	{
+		this->RemoveName(folder_it->second);
+		this->_folders.erase(folder_it);
+	}
+}
+
+void StvFolderNames::RenameFolder(uint32_t node, const QString &name)
+{
+	if(const auto folder_it = this->_folders.find(node); folder_it != this->_folders.end() && folder_it->second != name)
+	{
+		this->RemoveName(folder_it->second);
+		folder_it->second = name;
+		this->AddName(folder_it->second);
+	}
 }
 
-int StvSceneItem::type() const
-{	return StvItemModel::SCENE;	}
+void StvFolderNames::AddName(const QString &name)
+{
+	++this->_name_counts[name];
+}
+
+void StvFolderNames::RemoveName(const QString &name)
+{
+	const auto count_it = this->_name_counts.find(name);
+	if(count_it == this->_name_counts.end() || --count_it->second > 0)
+		return;
+
+	this->_name_counts.erase(count_it);
+
+	// Let name generation fill the freed number again
+	for(auto &format : this->_formats)
+	{
+		name_format_t &name_format = format.second;
+		if(name.size() <= name_format.Prefix.size() + name_format.Suffix.size() ||
+		        !name.startsWith(name_format.Prefix) || !name.endsWith(name_format.Suffix))
+			continue;
+
+		const QString number_str = name.mid(name_format.Prefix.size(), name.size() - name_format.Prefix.size() - name_format.Suffix.size());
+
+		bool is_number = false;
+		const int number = number_str.toInt(&is_number);
+		if(is_number && number > 0 && number < name_format.NextNumber && QString::number(number) == number_str)
+			name_format.NextNumber = number;
+	}
+}
 
 
 StvItemModel::StvItemModel()
-{}
+{
+	this->ResetNodes();
+
+	// Follow scene creation, removal and renaming to update the tree incrementally.
+	// The callbacks may run on any thread, changes are applied on the UI thread
+	signal_handler_t *sh = obs_get_signal_handler();
+	signal_handler_connect(sh, "source_create", &StvItemModel::obs_source_create_cb, this);
+	signal_handler_connect(sh, "source_remove", &StvItemModel::obs_source_remove_cb, this);
+	signal_handler_connect(sh, "source_destroy", &StvItemModel::obs_source_remove_cb, this);
+	signal_handler_connect(sh, "source_rename", &StvItemModel::obs_source_rename_cb, this);
+}
 
 StvItemModel::~StvItemModel()
 {
-	// Remove scene refs
-	for(auto &scene : this->_scenes_in_tree)
+	signal_handler_t *sh = obs_get_signal_handler();
+	signal_handler_disconnect(sh, "source_create", &StvItemModel::obs_source_create_cb, this);
+	signal_handler_disconnect(sh, "source_remove", &StvItemModel::obs_source_remove_cb, this);
+	signal_handler_disconnect(sh, "source_destroy", &StvItemModel::obs_source_remove_cb, this);
+	signal_handler_disconnect(sh, "source_rename", &StvItemModel::obs_source_rename_cb, this);
+
+	this->ClearSceneSettings();
+	this->_scenes_in_tree.clear();
+}
+
+QModelIndex StvItemModel::index(int row, int column, const QModelIndex &parent) const
+{
+	const uint32_t parent_node = this->NodeFromIndex(parent);
+	if(row < 0 || column != 0 || !this->IsFolderNode(parent_node))
+		return QModelIndex();
+
+	const std::vector<uint32_t> &children = this->Folder(parent_node).Children;
+	if(row >= (int)children.size())
+		return QModelIndex();
+
+	return this->createIndex(row, 0, (quintptr)children[row]);
+}
+
+QModelIndex StvItemModel::parent(const QModelIndex &child) const
+{
+	if(!child.isValid())
+		return QModelIndex();
+
+	return this->IndexFromNode(this->_nodes[this->NodeFromIndex(child)].Parent);
+}
+
+int StvItemModel::rowCount(const QModelIndex &parent) const
+{
+	const uint32_t parent_node = this->NodeFromIndex(parent);
+	if(parent.column() > 0 || !this->IsFolderNode(parent_node))
+		return 0;
+
+	return (int)this->Folder(parent_node).Children.size();
+}
+
+int StvItemModel::columnCount(const QModelIndex &/*parent*/) const
+{
+	return 1;
+}
+
+QVariant StvItemModel::data(const QModelIndex &index, int role) const
+{
+	if(!index.isValid())
+		return QVariant();
+
+	const uint32_t node = this->NodeFromIndex(index);
+	if(role == Qt::DisplayRole || role == Qt::EditRole)
+		return this->NodeName(node);
+	else if(role == Qt::DecorationRole)
 	{
-		obs_weak_source_release(scene.first);
+		const item_icon_t &item_icon = this->IsFolderNode(node) ? this->_folder_icon : this->_scene_icon;
+		return item_icon.Visible ? QVariant(item_icon.Icon) : QVariant();
 	}
+	else if(role == OBS_SCENE && !this->IsFolderNode(node))
+		return QVariant::fromValue(obs_weak_source_ptr({this->GetSceneSource(node)}));
 
-	this->_scenes_in_tree.clear();
+	return QVariant();
+}
+
+bool StvItemModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+	if(!index.isValid() || (role != Qt::EditRole && role != Qt::DisplayRole))
+		return false;
+
+	// Scenes are renamed by OBS, their node follows the name of the source
+	const uint32_t node = this->NodeFromIndex(index);
+	if(!this->IsFolderNode(node))
+		return false;
+
+	// Edited names are made unique before they're set, so that only the final name is recorded
+	this->SetNodeName(node, this->CreateUniqueFolderName(node, value.toString()));
+	return true;
+}
+
+Qt::ItemFlags StvItemModel::flags(const QModelIndex &index) const
+{
+	if(!index.isValid())
+		return Qt::ItemIsDropEnabled;
+
+	Qt::ItemFlags item_flags = Qt::ItemIsSelectable | Qt::ItemIsEnabled | Qt::ItemIsEditable | Qt::ItemIsDragEnabled;
+	if(this->IsFolderNode(this->NodeFromIndex(index)))
+		item_flags |= Qt::ItemIsDropEnabled;
+
+	return item_flags;
 }
 
 QStringList StvItemModel::mimeTypes() const
@@ -65,24 +238,13 @@ QMimeData *StvItemModel::mimeData(const QModelIndexList &indexes) const
 {
 	QMimeData *mime = new QMimeData();
 
-	const int num_indexes = indexes.size();
-
 	QByteArray mime_dat;
-	mime_dat.reserve(num_indexes*sizeof(mime_item_data_t)+sizeof(int));
-	mime_dat.append((const char*)&num_indexes, sizeof(int));
+	QDataStream stream(&mime_dat, QIODevice::WriteOnly);
+	stream << (quint32)indexes.size();
 
 	for(const auto &index : indexes)
 	{
-		mime_item_data_t item_mime_dat;
-
-		const QStandardItem *item = this->itemFromIndex(index);
-
-		assert(item->type() == FOLDER || item->type() == SCENE);
-		item_mime_dat.Type = (QITEM_TYPE)item->type();
-		item_mime_dat.Data = item_mime_dat.Type == QITEM_TYPE::FOLDER ? (void*)item :
-		                                                                (void*)item->data(OBS_SCENE).value<obs_weak_source_ptr>().ptr;
-
-		mime_dat.append((const char*)&item_mime_dat, sizeof(mime_item_data_t));
+		stream << (quint64)this->_nodes[this->NodeFromIndex(index)].NodeId;
 	}
 
 	mime->setData(MIME_TYPE.data(), mime_dat);
@@ -95,44 +257,211 @@ bool StvItemModel::dropMimeData(const QMimeData *data, Qt::DropAction action, in
 	Q_UNUSED(action);
 	Q_UNUSED(column);
 
-	QStandardItem *parent_item = this->itemFromIndex(parent);
-	if(!parent_item)
-		parent_item = this->invisibleRootItem();
-	else if(parent_item->type() == QITEM_TYPE::SCENE)
+	const uint32_t parent_node = this->NodeFromIndex(parent);
+	if(!this->IsFolderNode(parent_node))
 		return false;
 
 	if(row < 0)
 		row = 0;
 
-	QByteArray qdat = data->data(MIME_TYPE.data());
-	assert(qdat.size() >= (int)sizeof(int));
+	std::vector<uint32_t> nodes = this->ReadMimeItems(data->data(MIME_TYPE.data()));
 
-	const char *dat = qdat.constData();
+	// Children of dropped folders move along with them
+	const std::unordered_set<uint32_t> dropped_nodes(nodes.begin(), nodes.end());
+	nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [this, &dropped_nodes](uint32_t node) {
+		for(uint32_t ancestor = this->_nodes[node].Parent; ancestor != ROOT_NODE; ancestor = this->_nodes[ancestor].Parent)
+		{
+			if(dropped_nodes.count(ancestor))
+				return true;
+		}
 
-	const int num_indexes = *(int*)dat;
-	dat += sizeof(int);
+		return false;
+	}), nodes.end());
 
-	for(int i = 0; i < num_indexes; ++i)
+	// Keep the display order of the dropped nodes, independent of the order they were selected in
+	std::vector<std::pair<std::vector<int>, uint32_t>> ordered_nodes;
+	ordered_nodes.reserve(nodes.size());
+	for(const uint32_t node : nodes)
 	{
-		// Find item and move it
-		const mime_item_data_t *item_data = (const mime_item_data_t*)dat;
-		assert(item_data->Type == FOLDER || item_data->Type == SCENE);
-		if(item_data->Type == SCENE)
-			this->MoveSceneItem((obs_weak_source_t*)item_data->Data, row, parent_item);
-		else
-			this->MoveSceneFolder((QStandardItem*)item_data->Data, row, parent_item);
+		std::vector<int> path;
+		for(uint32_t ancestor = node; ancestor != ROOT_NODE; ancestor = this->_nodes[ancestor].Parent)
+			path.push_back((int)this->_nodes[ancestor].Row);
+
+		std::reverse(path.begin(), path.end());
+		ordered_nodes.emplace_back(std::move(path), node);
+	}
+
+	std::sort(ordered_nodes.begin(), ordered_nodes.end(), [](const auto &lhs, const auto &rhs) {
+		return lhs.first < rhs.first;
+	});
+
+	// Adjacent siblings are moved together by a single moveRows(). All nodes are moved before saving once
+	bool moved = false;
+	for(size_t first = 0; first < ordered_nodes.size();)
+	{
+		const node_t &first_node = this->_nodes[ordered_nodes[first].second];
+
+		size_t end = first + 1;
+		while(end < ordered_nodes.size() && this->_nodes[ordered_nodes[end].second].Parent == first_node.Parent &&
+		      this->_nodes[ordered_nodes[end].second].Row == first_node.Row + (end - first))
+			++end;
+
+		if(this->MoveNodes(ordered_nodes[first].second, (int)(end - first), row, parent_node))
+			moved = true;
+
+		// Place the next nodes behind the moved ones
+		const node_t &last_node = this->_nodes[ordered_nodes[end - 1].second];
+		if(last_node.Parent == parent_node)
+			row = (int)last_node.Row + 1;
+
+		first = end;
+	}
+
+	if(moved)
+		emit this->SceneTreeChanged();
+
+	// The nodes were already moved by moveRows(). If a move drop is reported as handled, the view removes the
+	// dragged source rows afterwards, which would remove the moved nodes. Returning false prevents that
+	return false;
+}
+
+Qt::DropActions StvItemModel::supportedDropActions() const
+{
+	// Dropped nodes are always moved
+	return Qt::MoveAction;
+}
+
+bool StvItemModel::hasChildren(const QModelIndex &parent) const
+{
+	const uint32_t parent_node = this->NodeFromIndex(parent);
+	if(parent.column() > 0 || !this->IsFolderNode(parent_node))
+		return false;
+
+	return !this->Folder(parent_node).Children.empty() || this->HasPendingChildren(parent_node);
+}
+
+bool StvItemModel::canFetchMore(const QModelIndex &parent) const
+{
+	return parent.isValid() && this->HasPendingChildren(this->NodeFromIndex(parent));
+}
+
+void StvItemModel::fetchMore(const QModelIndex &parent)
+{
+	if(parent.isValid())
+		this->FetchFolder(this->NodeFromIndex(parent));
+}
+
+bool StvItemModel::moveRows(const QModelIndex &sourceParent, int sourceRow, int count, const QModelIndex &destinationParent, int destinationChild)
+{
+	const uint32_t source_parent = this->NodeFromIndex(sourceParent);
+	const uint32_t dest_parent = this->NodeFromIndex(destinationParent);
+	if(!this->IsFolderNode(source_parent) || !this->IsFolderNode(dest_parent))
+		return false;
+
+	this->FetchFolder(dest_parent);
+
+	if(count <= 0 || sourceRow < 0 || sourceRow + count > (int)this->Folder(source_parent).Children.size() ||
+	        destinationChild < 0 || destinationChild > (int)this->Folder(dest_parent).Children.size())
+		return false;
+
+	// Folders can't be moved into themselves
+	for(uint32_t ancestor = dest_parent; ancestor != ROOT_NODE; ancestor = this->_nodes[ancestor].Parent)
+	{
+		const node_t &ancestor_node = this->_nodes[ancestor];
+		if(ancestor_node.Parent == source_parent && (int)ancestor_node.Row >= sourceRow && (int)ancestor_node.Row < sourceRow + count)
+			return false;
+	}
+
+	// Moving rows in front of or behind themselves doesn't change the tree
+	if(source_parent == dest_parent && destinationChild >= sourceRow && destinationChild <= sourceRow + count)
+		return false;
+
+	blog(LOG_DEBUG, "[%s] Moving %d item(s) starting with %s", obs_module_name(), count,
+	     this->NodeName(this->Folder(source_parent).Children[sourceRow]).toUtf8().constData());
 
-		dat += sizeof(obs_weak_source_ptr);
+	if(!this->beginMoveRows(sourceParent, sourceRow, sourceRow + count - 1, destinationParent, destinationChild))
+		return false;
+
+	// Only the links of the moved nodes change. Their children, and their index entries, move along with them
+	std::vector<uint32_t> &source_children = this->Folder(source_parent).Children;
+	const std::vector<uint32_t> nodes(source_children.begin() + sourceRow, source_children.begin() + sourceRow + count);
+	source_children.erase(source_children.begin() + sourceRow, source_children.begin() + sourceRow + count);
+	this->RenumberRows(source_parent, sourceRow);
+
+	// destinationChild refers to the position before the rows are taken out of their parent
+	int row = destinationChild;
+	if(source_parent == dest_parent && destinationChild > sourceRow)
+		row -= count;
+
+	std::vector<uint32_t> &dest_children = this->Folder(dest_parent).Children;
+	dest_children.insert(dest_children.begin() + row, nodes.begin(), nodes.end());
+	this->RenumberRows(dest_parent, row);
+
+	StvFolderNames *source_names = source_parent != dest_parent ? this->FindFolderNames(source_parent) : nullptr;
+	StvFolderNames *dest_names = source_parent != dest_parent ? this->FindFolderNames(dest_parent) : nullptr;
+	for(const uint32_t node : nodes)
+	{
+		this->_nodes[node].Parent = dest_parent;
+		if(!this->IsFolderNode(node))
+			continue;
+
+		if(source_names)
+			source_names->RemoveFolder(node);
+		if(dest_names)
+			dest_names->AddFolder(node, this->NodeName(node));
 	}
 
+	this->endMoveRows();
+
+	// Moves are recorded as such, not as removed and inserted rows
+	this->RecordMovedNodes(dest_parent, nodes, row);
+
+	if(source_parent != dest_parent)
+	{
+		// Check that names of moved folders are unique
+		for(const uint32_t node : nodes)
+		{
+			if(this->IsFolderNode(node))
+				this->SetNodeName(node, this->CreateUniqueFolderName(node, this->NodeName(node)));
+		}
+	}
+
+	return true;
+}
+
+bool StvItemModel::removeRows(int row, int count, const QModelIndex &parent)
+{
+	const uint32_t parent_node = this->NodeFromIndex(parent);
+	if(!this->IsFolderNode(parent_node) || count <= 0 || row < 0 || row + count > (int)this->Folder(parent_node).Children.size())
+		return false;
+
+	this->RemoveNodes(parent_node, row, count);
 	return true;
 }
 
-void StvItemModel::UpdateTree(obs_frontend_source_list &scene_list, const QModelIndex &selected_index)
+bool StvItemModel::IsFolder(const QModelIndex &index) const
+{
+	return index.isValid() && this->IsFolderNode(this->NodeFromIndex(index));
+}
+
+bool StvItemModel::IsScene(const QModelIndex &index) const
 {
-	this->UpdateSceneSize();
+	return index.isValid() && this->_nodes[this->NodeFromIndex(index)].Source != nullptr;
+}
+
+bool StvItemModel::UpdateTree(obs_frontend_source_list &scene_list, const QModelIndex &selected_index)
+{
+	this->ReadSceneSize();
+
+	// Renamed scenes are saved by UUID and don't change the tree
+	bool is_changed = false;
 
-	source_map_t new_scene_tree;
+	// New scenes are inserted into the folder of the selected node. Its pending items are only found in the current
+	// index, so they're created before scenes are moved to the new one
+	this->FetchFolder(this->GetInsertParent(selected_index));
+
+	scene_index_t new_scene_tree;
+	new_scene_tree.reserve(scene_list.sources.num);
 
 	for (size_t i = 0; i < scene_list.sources.num; i++)
 	{
@@ -142,105 +471,89 @@ void StvItemModel::UpdateTree(obs_frontend_source_list &scene_list, const QModel
 		if(!this->IsManagedScene(source))
 			continue;
 
-		source_map_t::iterator scene_it;
-
-		// Check if scene already in tree
-		obs_weak_source_t *weak = obs_source_get_weak_source(source);
-
-		scene_it = this->_scenes_in_tree.find(weak);
-		if(scene_it != this->_scenes_in_tree.end())
+		// Check if scene already in tree. Stale entries whose source pointer was reused stay in the old index and are removed below
+		scene_index_t::iterator scene_it = this->_scenes_in_tree.find(source);
+		if(scene_it != this->_scenes_in_tree.end() && obs_weak_source_references_source(scene_it->second.Weak, source))
 		{
-			// if already in tree, move to new set
-			auto new_scene_it = new_scene_tree.emplace(scene_it->first, scene_it->second).first;
+			// if already in tree, move to new index
+			auto new_scene_it = new_scene_tree.emplace(source, std::move(scene_it->second)).first;
 			this->_scenes_in_tree.erase(scene_it);
 			scene_it = new_scene_it;
 
-			obs_weak_source_release(weak);
+			// Update scene name. Only renamed nodes emit dataChanged
+			// Scenes in folders that weren't expanded yet get their name when their node is created
+			if(scene_it->second.Node != INVALID_NODE)
+				this->SetNodeName(scene_it->second.Node, QString::fromUtf8(obs_source_get_name(source)));
 		}
 		else
-		{
-			// if not in tree, add it
-			scene_it = new_scene_tree.emplace(weak, nullptr).first;
-		}
-
-		weak = nullptr;
-
-		// Check that scene contains tree data
-		obs_data_t *scene_dat = obs_source_get_private_settings(OBSGetStrongRef(scene_it->first).Get());
-
-		if(!scene_it->second)
 		{
 			// Scene not yet in tree, add it at the correct position
-			QStandardItem *selected = this->itemFromIndex(selected_index);
-			QStandardItem *parent;
-			if(selected)
-			{
-				assert(selected->type() == QITEM_TYPE::SCENE || selected->type() == QITEM_TYPE::FOLDER);
-
-				if(selected->type() == QITEM_TYPE::FOLDER)
-					parent = selected;
-				else
-					parent = this->GetParentOrRoot(selected->index());
-			}
-			else
-			{
-				selected = this->invisibleRootItem();
-				parent = selected;
-			}
+			const uint32_t node = this->InsertSceneNode(source, selected_index);
 
-			// Add new item to scene
-			StvSceneItem *pItem = new StvSceneItem(obs_source_get_name(source), scene_it->first);
+			new_scene_tree.emplace(source, scene_entry_t{OBSGetWeakRef(source), node});
+			is_changed = true;
+		}
+	}
 
-			const auto row = parent == selected ? 0 : selected->row();
-			parent->insertRow(row, pItem);
+	// Erase all remaining elements of the previous index. Freed nodes only release entries of the new index that refer to them
+	const scene_index_t removed_scenes = std::move(this->_scenes_in_tree);
+	this->_scenes_in_tree = std::move(new_scene_tree);
 
-			scene_it->second = pItem;
-		}
-		else
+	for(const auto &scene : removed_scenes)
+	{
+		// Pending scenes without an entry in the index are skipped once their folder is expanded
+		const uint32_t node = scene.second.Node;
+		is_changed = true;
+		if(node == INVALID_NODE)
 		{
-			// Update scene name
-			scene_it->second->setText(obs_source_get_name(source));
+			this->RecordDelete(scene.second.PendingNodeId);
+			continue;
 		}
 
-		obs_data_release(scene_dat);
-		scene_dat = nullptr;
+		this->RemoveNodes(this->_nodes[node].Parent, (int)this->_nodes[node].Row, 1);
 	}
 
-	// Erase all remaining elements in _scene_tree
-	for(const auto &scene : this->_scenes_in_tree)
-	{
-		assert(scene.second);
+	// Every indexed scene has to be part of the tree, either as a node or as a pending item of a folder
+	const size_t tree_scene_count = this->CountTreeScenes(ROOT_NODE);
+	if(tree_scene_count != this->_scenes_in_tree.size())
+		blog(LOG_WARNING, "[%s] Scene tree contains %zu scenes, but %zu scenes are indexed", obs_module_name(), tree_scene_count,
+		     this->_scenes_in_tree.size());
 
-		const int row = scene.second->row();
-		this->removeRow(row, this->parent(scene.second->index()));
+	assert(tree_scene_count == this->_scenes_in_tree.size());
 
-		// Remove scene reference
-		obs_weak_source_release(scene.first);
-	}
+	return is_changed;
+}
 
-	this->_scenes_in_tree = std::move(new_scene_tree);
+void StvItemModel::SetCurrentIndex(const QModelIndex &index)
+{
+	this->_current_index = index;
 }
 
-bool StvItemModel::CheckFolderNameUniqueness(const QString &name, QStandardItem *parent, QStandardItem *item_to_skip)
+bool StvItemModel::CheckFolderNameUniqueness(const QString &name, const QModelIndex &parent, const QModelIndex &index_to_skip)
 {
-	const int row_count = parent->rowCount();
-	for(int i=0; i<row_count; ++i)
-	{
-		QStandardItem *item = parent->child(i);
-		if(item == item_to_skip)
-			continue;
+	return this->GetFolderNames(this->NodeFromIndex(parent)).IsUnique(name, index_to_skip.isValid() ? this->NodeFromIndex(index_to_skip) :
+	                                                                                                 INVALID_NODE);
+}
 
-		if(item->type() == FOLDER && item->text() == name)
-			return false;
-	}
+QModelIndex StvItemModel::InsertFolder(const QModelIndex &parent, int row, const QString &name)
+{
+	const uint32_t parent_node = this->NodeFromIndex(parent);
+	if(!this->IsFolderNode(parent_node))
+		return QModelIndex();
 
-	return true;
+	// New folders are placed relative to the saved items
+	this->FetchFolder(parent_node);
+	row = std::clamp(row, 0, (int)this->Folder(parent_node).Children.size());
+
+	const uint32_t node = this->CreateFolderNode(name, 0, false);
+	this->InsertNodes(parent_node, row, {node});
+
+	return this->IndexFromNode(node);
 }
 
-void StvItemModel::SetSelectedScene(QStandardItem *item, bool set_preview_scene, bool force_set_scene)
+void StvItemModel::SetSelectedScene(const QModelIndex &index, bool set_preview_scene, bool force_set_scene)
 {
-	obs_weak_source_t *weak = item->data(QDATA_ROLE::OBS_SCENE).value<obs_weak_source_ptr>().ptr;
-	OBSSourceAutoRelease source = OBSGetStrongRef(weak);
+	OBSSource source = OBSGetStrongRef(this->GetSceneSource(index));
 	if(source)
 	{
 		if(!set_preview_scene)
@@ -253,18 +566,24 @@ void StvItemModel::SetSelectedScene(QStandardItem *item, bool set_preview_scene,
 	}
 }
 
-QStandardItem *StvItemModel::GetCurrentSceneItem()
+QModelIndex StvItemModel::GetCurrentSceneIndex()
 {
 	// Change source to the selected one
 	OBSSourceAutoRelease source = this->GetCurrentScene();
-	OBSWeakSource weak = OBSGetWeakRef(source);
 
-	if(auto scene_it = this->_scenes_in_tree.find(weak); scene_it != this->_scenes_in_tree.end())
-		return scene_it->second;
+	// Create the nodes of the folders containing the scene if they weren't expanded yet
+	const scene_entry_t *scene_entry = this->FindSceneEntry(source);
+	while(scene_entry && scene_entry->Node == INVALID_NODE && this->HasPendingChildren(scene_entry->PendingFolder))
+	{
+		this->FetchFolder(scene_entry->PendingFolder);
+	}
+
+	if(scene_entry && scene_entry->Node != INVALID_NODE)
+		return this->IndexFromNode(scene_entry->Node);
 	else
 	{
 		blog(LOG_WARNING, "[%s] Couldn't find current scene in Scene Tree View", obs_module_name());
-		return nullptr;
+		return QModelIndex();
 	}
 }
 
@@ -273,142 +592,342 @@ OBSSourceAutoRelease StvItemModel::GetCurrentScene()
 	return obs_frontend_preview_program_mode_active() ? obs_frontend_get_current_preview_scene() : obs_frontend_get_current_scene();
 }
 
-void StvItemModel::SaveSceneTree(obs_data_t *root_folder_data, const char *scene_collection, QTreeView *view)
+obs_weak_source_t *StvItemModel::GetSceneSource(const QModelIndex &index) const
+{
+	return index.isValid() ? this->GetSceneSource(this->NodeFromIndex(index)) : nullptr;
+}
+
+void StvItemModel::CaptureSceneTree(StvTreeSnapshot &snapshot)
+{
+	this->CaptureFolder(ROOT_NODE, snapshot);
+}
+
+void StvItemModel::LoadSceneTree(obs_data_t *root_folder_data, const char *scene_collection)
 {
-	OBSDataArrayAutoRelease folder_data = this->CreateFolderArray(*this->invisibleRootItem(), view);
-	obs_data_set_array(root_folder_data, scene_collection, folder_data);
+	this->LoadItems([this, root_folder_data, scene_collection](load_context_t &context, std::vector<stv_pending_item_t> &root_items) {
+		OBSDataArrayAutoRelease folder_array = obs_data_get_array(root_folder_data, scene_collection);
+		if(folder_array)
+			this->LoadFolderArray(folder_array, context, root_items);
+	});
 }
 
-void StvItemModel::LoadSceneTree(obs_data_t *root_folder_data, const char *scene_collection, QTreeView *view)
+void StvItemModel::LoadSceneTree(const StvTreeImage &tree_image)
 {
-	this->UpdateSceneSize();
+	this->LoadItems([this, &tree_image](load_context_t &context, std::vector<stv_pending_item_t> &root_items) {
+		this->LoadImageNodes(tree_image, 0, tree_image.NodeCount(), context, root_items);
+	});
+}
 
-	QStandardItem *root_item = this->invisibleRootItem();
+void StvItemModel::LoadItems(const read_items_t &read_items)
+{
+	const uint64_t load_start_ns = os_gettime_ns();
 
-	// Erase previous data
-	this->CleanupSceneTree();
+	this->ReadSceneSize();
 
-	// Add loaded data
-	OBSDataArrayAutoRelease folder_array = obs_data_get_array(root_folder_data, scene_collection);
-	if(folder_array)
-	{
-		std::list<StvFolderItem*> expandable_folders;
-		this->LoadFolderArray(folder_array, *root_item, expandable_folders);
+	// Erase previous scene refs
+	this->_track_scenes = false;
+	this->_scenes_in_tree.clear();
 
-		for(auto &item : expandable_folders)
-		{
-			view->setExpanded(item->index(), true);
-		}
+	// Resolve saved scenes against a single snapshot of the scene list instead of looking up every name
+	obs_frontend_source_list scene_list = {};
+	obs_frontend_get_scenes(&scene_list);
+
+	load_context_t load_context;
+	load_context.UuidTable.reserve(scene_list.sources.num);
+	load_context.SceneTable.reserve(scene_list.sources.num);
+	for(size_t i = 0; i < scene_list.sources.num; ++i)
+	{
+		obs_source_t *source = scene_list.sources.array[i];
+		load_context.UuidTable.emplace(obs_source_get_uuid(source), source);
+		load_context.SceneTable.emplace(obs_source_get_name(source), source);
 	}
-}
 
-void StvItemModel::CleanupSceneTree()
-{
-	// Remove scene refs
-	for(auto &scene : this->_scenes_in_tree)
+	// Only read the saved items first. Scenes are added to the index right away, but nodes are
+	// only created for folders that are visible
+	std::vector<stv_pending_item_t> root_items;
+	read_items(load_context, root_items);
+
+	load_context.UuidTable.clear();
+	load_context.SceneTable.clear();
+	obs_frontend_source_list_free(&scene_list);
+
+	// Trees of previous versions only contain scene names
+	this->_tree_outdated = load_context.ResolvedByName > 0;
+	if(load_context.ResolvedByName > 0)
+		blog(LOG_INFO, "[%s] Resolved %zu scenes of the scene tree by name", obs_module_name(), load_context.ResolvedByName);
+
+	// Recorded edits refer to rows of the model. Saved items that weren't loaded would shift them when they're
+	// applied to the saved tree
+	if(load_context.SkippedScenes > 0)
 	{
-		obs_weak_source_release(scene.first);
+		blog(LOG_INFO, "[%s] Skipped %zu saved scenes of the scene tree", obs_module_name(), load_context.SkippedScenes);
+		this->_tree_outdated = true;
 	}
 
-	this->_scenes_in_tree.clear();
+	// Items of trees saved by previous versions, and duplicates, get new node IDs
+	this->_next_node_id = 0;
+	for(const uint64_t node_id : load_context.NodeIds)
+		this->_next_node_id = std::max(this->_next_node_id, node_id);
+
+	const uint64_t last_saved_node_id = this->_next_node_id;
+	this->AssignNodeIds(root_items);
+
+	// Journaled edits refer to node IDs, so new IDs have to be saved before edits are journaled
+	if(this->_next_node_id != last_saved_node_id)
+		this->_tree_outdated = true;
 
-	QStandardItem *root_item = this->invisibleRootItem();
-	root_item->removeRows(0, root_item->rowCount());
+	// Replace previous data with a single model reset. No view is notified per created node
+	this->beginResetModel();
+	this->ResetNodes();
+	this->AttachNodes(ROOT_NODE, 0, this->CreateFolderNodes(std::move(root_items), true));
+	this->endResetModel();
+
+	this->_track_scenes = true;
+
+	blog(LOG_INFO, "[%s] Loaded scene tree with %zu scenes in %.3f ms", obs_module_name(), this->_scenes_in_tree.size(),
+	     (os_gettime_ns() - load_start_ns) / 1000000.0);
 }
 
-QStandardItem *StvItemModel::GetParentOrRoot(const QModelIndex &index)
+void StvItemModel::CleanupSceneTree()
 {
-	QStandardItem *selected = this->itemFromIndex(this->parent(index));
-	if(!selected)
-		selected = this->invisibleRootItem();
+	// Remove scene refs
+	this->_track_scenes = false;
+	this->_scenes_in_tree.clear();
+	this->ClearSceneSettings();
 
-	return selected;
+	// Unloading the tree isn't an edit
+	this->beginResetModel();
+	this->ResetNodes();
+	this->endResetModel();
 }
 
-QString StvItemModel::CreateUniqueFolderName(QStandardItem *folder_item, QStandardItem *parent)
+QString StvItemModel::CreateUniqueFolderName(uint32_t folder, QString folder_name)
 {
 	// Check that name is unique
-	QString folder_name = folder_item->text();
-	if(!this->CheckFolderNameUniqueness(folder_name, parent, folder_item))
+	StvFolderNames &folder_names = this->GetFolderNames(this->_nodes[folder].Parent);
+	if(!folder_names.IsUnique(folder_name, folder))
 	{
 		QString format = folder_name.replace(QRegularExpression("\\d+$"), "%1");
 		if(!format.endsWith("%1"))
 			format += " %1";
 
-		size_t i = 0;
-		QString name;
-		do
+		folder_name = folder_names.CreateUniqueName(format, folder);
+	}
+
+	return folder_name;
+}
+
+QString StvItemModel::CreateFolderName(const QString &format, const QModelIndex &parent)
+{
+	return this->GetFolderNames(this->NodeFromIndex(parent)).CreateUniqueName(format);
+}
+
+StvFolderNames &StvItemModel::GetFolderNames(uint32_t parent)
+{
+	assert(this->IsFolderNode(parent));
+
+	// Names of pending sub folders must be indexed as well
+	this->FetchFolder(parent);
+
+	folder_t &folder = this->Folder(parent);
+	if(!folder.ChildNames.IsIndexed())
+	{
+		folder.ChildNames.SetIndexed();
+		for(const uint32_t child : folder.Children)
 		{
-			name = format.arg(QString::number(++i));
+			if(this->IsFolderNode(child))
+				folder.ChildNames.AddFolder(child, this->NodeName(child));
 		}
-		while(!this->CheckFolderNameUniqueness(name, parent, folder_item));
-
-		folder_name = name;
 	}
 
-	return folder_name;
+	return folder.ChildNames;
 }
 
-void StvItemModel::SetIconVisibility(bool enable_visibility, QITEM_TYPE item_type)
+StvFolderNames *StvItemModel::FindFolderNames(uint32_t parent)
 {
-	if(item_type == SCENE)
-		return this->SetSceneIconVisibility(enable_visibility);
-	else
-		return this->SetFolderIconVisibility(enable_visibility);
+	// Folders that were never queried are indexed on first use
+	if(!this->IsFolderNode(parent))
+		return nullptr;
+
+	StvFolderNames &folder_names = this->Folder(parent).ChildNames;
+	return folder_names.IsIndexed() ? &folder_names : nullptr;
 }
 
-void StvItemModel::SetSceneIconVisibility(bool enable_visibility)
+void StvItemModel::UpdateIcons()
 {
+	// Icons depend on the theme, reload them from the main window
 	QMainWindow *main_window = reinterpret_cast<QMainWindow*>(obs_frontend_get_main_window());
-	QIcon icon = enable_visibility ? main_window->property("sceneIcon").value<QIcon>() : QIcon();
+	this->_scene_icon.Icon = main_window->property("sceneIcon").value<QIcon>();
+	this->_folder_icon.Icon = main_window->property("groupIcon").value<QIcon>();
+
+	config_t *const user_config = obs_frontend_get_user_config();
+	this->_scene_icon.Visible = config_get_bool(user_config, "SceneTreeView", "ShowSceneIcons");
+	this->_folder_icon.Visible = config_get_bool(user_config, "SceneTreeView", "ShowFolderIcons");
 
-	return this->SetIcon(icon, SCENE, this->invisibleRootItem());
+	this->RefreshIcons();
 }
 
-void StvItemModel::SetFolderIconVisibility(bool enable_visibility)
+void StvItemModel::SetIconVisibility(bool enable_visibility, QITEM_TYPE item_type)
 {
-	QMainWindow *main_window = reinterpret_cast<QMainWindow*>(obs_frontend_get_main_window());
-	QIcon icon = enable_visibility ? main_window->property("groupIcon").value<QIcon>() : QIcon();
+	item_icon_t &item_icon = item_type == SCENE ? this->_scene_icon : this->_folder_icon;
+	if(item_icon.Visible == enable_visibility)
+		return;
 
-	return this->SetIcon(icon, FOLDER, this->invisibleRootItem());
+	item_icon.Visible = enable_visibility;
+	this->RefreshIcons();
 }
 
 void StvItemModel::UpdateSceneSize()
 {
-	this->_scene_size.cx = config_get_int(obs_frontend_get_profile_config(), "Video", "BaseCX");
-	this->_scene_size.cy = config_get_int(obs_frontend_get_profile_config(), "Video", "BaseCY");
+	// A new base resolution can change which scenes are managed. The cached scene sizes are re-evaluated once
+	if(this->ReadSceneSize() && this->_track_scenes)
+		this->ReevaluateManagedScenes();
 }
 
-bool StvItemModel::IsManagedScene(obs_scene_t *scene) const
+bool StvItemModel::IsManagedScene(obs_scene_t *scene)
 {
-	OBSSource source = obs_scene_get_source(scene);
+	obs_source_t *source = obs_scene_get_source(scene);
 	return this->IsManagedScene(source);
 }
 
-bool StvItemModel::IsManagedScene(obs_source_t *scene_source) const
+bool StvItemModel::IsManagedScene(obs_source_t *scene_source)
 {
-	OBSDataAutoRelease settings = obs_source_get_settings(scene_source);
-	return	obs_data_get_bool(settings, "custom_size") == false /*&&
-			obs_data_get_bool(settings, "cx") == this->_scene_size.cx &&
-					obs_data_get_bool(settings, "cy") == this->_scene_size.cy*/;
-}
+	auto settings_it = this->_scene_settings.find(scene_source);
+	if(settings_it == this->_scene_settings.end() || !obs_weak_source_references_source(settings_it->second.Weak, scene_source))
+	{
+		// First check of this scene. Cache its size settings and refresh them whenever the scene is updated
+		scene_settings_t &settings = this->_scene_settings[scene_source];
+		settings.Weak = OBSGetWeakRef(scene_source);
+		this->ReadSceneSettings(scene_source, settings);
 
+		signal_handler_connect(obs_source_get_signal_handler(scene_source), "update", &StvItemModel::obs_scene_update_cb, this);
 
-bool StvItemModel::MoveIndexByOne(const QModelIndex &index, int delta)
-{
-	if (!index.isValid())
-		return false;
+		return this->IsManagedSize(settings);
+	}
 
-	QStandardItem *item = this->itemFromIndex(index);
-	if (!item)
-		return false;
+	return this->IsManagedSize(settings_it->second);
+}
 
-	QStandardItem *parent_item = this->itemFromIndex(index.parent());
-	if (!parent_item)
-		parent_item = this->invisibleRootItem();
+bool StvItemModel::ReadSceneSize()
+{
+	const SCENE_SIZE_T scene_size = {
+	    (uint32_t)config_get_int(obs_frontend_get_profile_config(), "Video", "BaseCX"),
+	    (uint32_t)config_get_int(obs_frontend_get_profile_config(), "Video", "BaseCY")};
+
+	const bool changed = scene_size.cx != this->_scene_size.cx || scene_size.cy != this->_scene_size.cy;
+	this->_scene_size = scene_size;
+
+	return changed;
+}
+
+bool StvItemModel::IsManagedSize(const scene_settings_t &settings) const
+{
+	// Only scenes rendered at the base resolution are shown
+	return !settings.CustomSize ||
+	        (settings.Size.cx == this->_scene_size.cx && settings.Size.cy == this->_scene_size.cy);
+}
+
+void StvItemModel::ReadSceneSettings(obs_source_t *scene_source, scene_settings_t &settings)
+{
+	OBSDataAutoRelease data = obs_source_get_settings(scene_source);
+	settings.CustomSize = obs_data_get_bool(data, "custom_size");
+	settings.Size.cx = (uint32_t)obs_data_get_int(data, "cx");
+	settings.Size.cy = (uint32_t)obs_data_get_int(data, "cy");
+}
+
+void StvItemModel::UpdateSceneSettings(obs_source_t *source, const OBSWeakSource &weak)
+{
+	const auto settings_it = this->_scene_settings.find(source);
+	if(settings_it == this->_scene_settings.end() || settings_it->second.Weak.Get() != weak.Get())
+		return;
+
+	OBSSource strong = OBSGetStrongRef(weak);
+	if(!strong)
+		return;
+
+	this->ReadSceneSettings(source, settings_it->second);
+
+	if(this->_track_scenes && this->ApplyManagedState(source))
+		emit this->SceneTreeChanged();
+}
+
+void StvItemModel::ReleaseSceneSettings(obs_source_t *source, const OBSWeakSource &weak)
+{
+	// Drop entries of destroyed scenes. Their signal handler was destroyed with them
+	const auto settings_it = this->_scene_settings.find(source);
+	if(settings_it != this->_scene_settings.end() && settings_it->second.Weak.Get() == weak.Get() &&
+	        obs_weak_source_expired(weak))
+		this->_scene_settings.erase(settings_it);
+}
+
+void StvItemModel::ClearSceneSettings()
+{
+	for(const auto &settings : this->_scene_settings)
+	{
+		OBSSource source = OBSGetStrongRef(settings.second.Weak);
+		if(source)
+			signal_handler_disconnect(obs_source_get_signal_handler(source), "update", &StvItemModel::obs_scene_update_cb, this);
+	}
+
+	this->_scene_settings.clear();
+}
+
+bool StvItemModel::ApplyManagedState(obs_source_t *source)
+{
+	if(obs_source_removed(source))
+		return false;
+
+	const bool managed = this->IsManagedScene(source);
+
+	auto scene_it = this->_scenes_in_tree.find(source);
+	if(scene_it != this->_scenes_in_tree.end() && !obs_weak_source_references_source(scene_it->second.Weak, source))
+	{
+		// Drop stale entry of a destroyed scene
+		this->EraseSceneItem(scene_it);
+		scene_it = this->_scenes_in_tree.end();
+	}
+
+	const bool in_tree = scene_it != this->_scenes_in_tree.end();
+	if(managed && !in_tree)
+		this->AddSceneToIndex(source, this->InsertSceneNode(source, this->_current_index));
+	else if(!managed && in_tree)
+		this->EraseSceneItem(scene_it);
+	else
+		return false;
+
+	return true;
+}
+
+void StvItemModel::ReevaluateManagedScenes()
+{
+	std::vector<OBSSource> scenes;
+	scenes.reserve(this->_scene_settings.size());
+	for(const auto &settings : this->_scene_settings)
+	{
+		OBSSource source = OBSGetStrongRef(settings.second.Weak);
+		if(source)
+			scenes.push_back(std::move(source));
+	}
+
+	bool changed = false;
+	for(const auto &source : scenes)
+	{
+		changed |= this->ApplyManagedState(source);
+	}
 
+	if(changed)
+		emit this->SceneTreeChanged();
+}
+
+
+bool StvItemModel::MoveIndexByOne(const QModelIndex &index, int delta)
+{
+	if (!index.isValid())
+		return false;
+
+	const QModelIndex parent = index.parent();
 	const int row = index.row();
-	const int rowCount = parent_item->rowCount();
+	const int rowCount = this->rowCount(parent);
 	int insertPos = row + delta;
 	// For moving down, insert after the next item (to land at row+1 after removal)
 	if (delta > 0)
@@ -417,102 +936,465 @@ bool StvItemModel::MoveIndexByOne(const QModelIndex &index, int delta)
 	if (insertPos < 0 || insertPos > rowCount)
 		return false;
 
-	if (item->type() == SCENE) {
-		obs_weak_source_t *weak = item->data(OBS_SCENE).value<obs_weak_source_ptr>().ptr;
-		this->MoveSceneItem(weak, insertPos, parent_item);
-	} else if (item->type() == FOLDER) {
-		this->MoveSceneFolder(item, insertPos, parent_item);
-	} else {
-		return false;
+	// The node is taken out and reinserted, so it lands at row+delta
+	return this->MoveNodes(this->NodeFromIndex(index), 1, insertPos, this->NodeFromIndex(parent));
+}
+
+uint32_t StvItemModel::NodeFromIndex(const QModelIndex &index) const
+{
+	if(!index.isValid())
+		return ROOT_NODE;
+
+	assert(index.model() == this);
+	return (uint32_t)index.internalId();
+}
+
+QModelIndex StvItemModel::IndexFromNode(uint32_t node) const
+{
+	if(node == ROOT_NODE || node == INVALID_NODE)
+		return QModelIndex();
+
+	return this->createIndex((int)this->_nodes[node].Row, 0, (quintptr)node);
+}
+
+bool StvItemModel::IsFolderNode(uint32_t node) const
+{
+	return node < this->_nodes.size() && this->_nodes[node].Folder != INVALID_NODE;
+}
+
+bool StvItemModel::HasPendingChildren(uint32_t node) const
+{
+	return this->IsFolderNode(node) && !this->Folder(node).PendingChildren.empty();
+}
+
+StvItemModel::folder_t &StvItemModel::Folder(uint32_t node)
+{
+	assert(this->IsFolderNode(node));
+	return this->_folders[this->_nodes[node].Folder];
+}
+
+const StvItemModel::folder_t &StvItemModel::Folder(uint32_t node) const
+{
+	assert(this->IsFolderNode(node));
+	return this->_folders[this->_nodes[node].Folder];
+}
+
+const QString &StvItemModel::NodeName(uint32_t node) const
+{
+	return this->_names[this->_nodes[node].NameId];
+}
+
+uint32_t StvItemModel::InternName(const QString &name)
+{
+	if(const auto name_it = this->_name_ids.find(name); name_it != this->_name_ids.end())
+		return name_it->second;
+
+	const uint32_t name_id = (uint32_t)this->_names.size();
+	this->_names.push_back(name);
+	this->_name_ids.emplace(name, name_id);
+
+	return name_id;
+}
+
+void StvItemModel::ResetNodes()
+{
+	this->_nodes.clear();
+	this->_folders.clear();
+	this->_free_nodes.clear();
+	this->_free_folders.clear();
+	this->_names.clear();
+	this->_name_ids.clear();
+
+	// The root folder has no name
+	this->InternName(QString());
+	this->_folders.emplace_back();
+	this->_nodes.emplace_back();
+	this->_nodes[ROOT_NODE].Folder = 0;
+}
+
+uint32_t StvItemModel::CreateNode()
+{
+	if(!this->_free_nodes.empty())
+	{
+		const uint32_t node = this->_free_nodes.back();
+		this->_free_nodes.pop_back();
+		return node;
 	}
 
-	// Remove the original row. When inserting below (delta>0), original stays at 'row'.
-	// When inserting above (delta<0), original shifts down to 'row+1'.
-	if (delta > 0)
-		parent_item->removeRow(row);
+	this->_nodes.emplace_back();
+	return (uint32_t)this->_nodes.size() - 1;
+}
+
+uint32_t StvItemModel::CreateFolderNode(const QString &name, uint64_t node_id, bool expanded)
+{
+	uint32_t folder;
+	if(!this->_free_folders.empty())
+	{
+		folder = this->_free_folders.back();
+		this->_free_folders.pop_back();
+	}
 	else
-		parent_item->removeRow(row + 1);
+	{
+		this->_folders.emplace_back();
+		folder = (uint32_t)this->_folders.size() - 1;
+	}
 
-	return true;
+	this->_folders[folder].IsExpanded = expanded;
+
+	const uint32_t name_id = this->InternName(name);
+	const uint32_t node = this->CreateNode();
+
+	node_t &folder_node = this->_nodes[node];
+	folder_node.NameId = name_id;
+	folder_node.Folder = folder;
+	folder_node.NodeId = node_id;
+
+	return node;
 }
 
-void StvItemModel::MoveSceneItem(obs_weak_source_t *source, int row, QStandardItem *parent_item)
+uint32_t StvItemModel::CreateSceneNode(obs_source_t *source, const QString &name, uint64_t node_id)
 {
-	if(const auto scene_it = this->_scenes_in_tree.find(source); scene_it != this->_scenes_in_tree.end())
+	const uint32_t name_id = this->InternName(name);
+	const uint32_t node = this->CreateNode();
+
+	node_t &scene_node = this->_nodes[node];
+	scene_node.NameId = name_id;
+	scene_node.Source = source;
+	scene_node.NodeId = node_id;
+
+	return node;
+}
+
+void StvItemModel::FreeNode(uint32_t node)
+{
+	node_t &item = this->_nodes[node];
+	if(this->IsFolderNode(node))
 	{
-		assert(scene_it->second->type() == SCENE);
+		folder_t &folder = this->_folders[item.Folder];
+		for(const uint32_t child : folder.Children)
+			this->FreeNode(child);
 
-		blog(LOG_INFO, "[%s] Moving %s", obs_module_name(), scene_it->second->text().toStdString().c_str());
+		// Scenes of folders that weren't expanded yet leave the index with them
+		this->ErasePendingScenes(folder.PendingChildren);
 
-		StvSceneItem *pItem = new StvSceneItem(scene_it->second->text(), scene_it->first);
-		parent_item->insertRow(row, pItem);
+		folder = folder_t();
+		this->_free_folders.push_back(item.Folder);
+	}
+	else if(const auto scene_it = this->_scenes_in_tree.find(item.Source); scene_it != this->_scenes_in_tree.end() &&
+	        scene_it->second.Node == node)
+		this->_scenes_in_tree.erase(scene_it);
 
-		// Old item removed when returning true
+	item = node_t();
+	this->_free_nodes.push_back(node);
+}
 
-		scene_it->second = pItem;
+void StvItemModel::ErasePendingScenes(const std::vector<stv_pending_item_t> &pending_items)
+{
+	for(const auto &pending_item : pending_items)
+	{
+		if(pending_item.IsFolder)
+			this->ErasePendingScenes(pending_item.Children);
+		else if(const auto scene_it = this->_scenes_in_tree.find(pending_item.Source);
+		        scene_it != this->_scenes_in_tree.end() && scene_it->second.Node == INVALID_NODE)
+			this->_scenes_in_tree.erase(scene_it);
 	}
-	else
-		blog(LOG_WARNING, "[%s] Couldn't find item to move in Scene Tree View", obs_module_name());
 }
 
-void StvItemModel::MoveSceneFolder(QStandardItem *item, int row, QStandardItem *parent_item)
+void StvItemModel::AttachNodes(uint32_t parent, int row, const std::vector<uint32_t> &nodes)
 {
-	assert(item->type() == FOLDER);
-	blog(LOG_INFO, "[%s] Moving %s", obs_module_name(), item->text().toStdString().c_str());
+	std::vector<uint32_t> &children = this->Folder(parent).Children;
+	children.insert(children.begin() + row, nodes.begin(), nodes.end());
+	this->RenumberRows(parent, row);
 
-	// Check that name is unique
-	QString new_name = this->CreateUniqueFolderName(item, parent_item);
+	// New nodes get a node ID
+	StvFolderNames *folder_names = this->FindFolderNames(parent);
+	for(const uint32_t node : nodes)
+	{
+		node_t &item = this->_nodes[node];
+		item.Parent = parent;
+		if(!item.NodeId)
+			item.NodeId = ++this->_next_node_id;
+
+		if(folder_names && this->IsFolderNode(node))
+			folder_names->AddFolder(node, this->NodeName(node));
+	}
+}
+
+void StvItemModel::InsertNodes(uint32_t parent, int row, const std::vector<uint32_t> &nodes)
+{
+	if(nodes.empty())
+		return;
+
+	this->beginInsertRows(this->IndexFromNode(parent), row, row + (int)nodes.size() - 1);
+	this->AttachNodes(parent, row, nodes);
+	this->endInsertRows();
+
+	for(const uint32_t node : nodes)
+		this->RecordInsertedNode(node);
+}
+
+void StvItemModel::RemoveNodes(uint32_t parent, int row, int count)
+{
+	this->beginRemoveRows(this->IndexFromNode(parent), row, row + count - 1);
 
-	StvFolderItem *new_item = new StvFolderItem(new_name);
-	parent_item->insertRow(row, new_item);
+	std::vector<uint32_t> &children = this->Folder(parent).Children;
+	const std::vector<uint32_t> nodes(children.begin() + row, children.begin() + row + count);
+	children.erase(children.begin() + row, children.begin() + row + count);
+	this->RenumberRows(parent, row);
 
-	for(int sub_row = 0; sub_row < item->rowCount(); ++sub_row)
+	StvFolderNames *folder_names = this->FindFolderNames(parent);
+	for(const uint32_t node : nodes)
 	{
-		QStandardItem *sub_item = item->child(sub_row);
+		this->RecordDelete(this->_nodes[node].NodeId);
 
-		assert(sub_item->type() == FOLDER || sub_item->type() == SCENE);
+		if(folder_names)
+			folder_names->RemoveFolder(node);
 
-		if(sub_item->type() == FOLDER)
-			this->MoveSceneFolder(sub_item, sub_row, new_item);
-		else
-		{
-			obs_weak_source_t *weak = sub_item->data(OBS_SCENE).value<obs_weak_source_ptr>().ptr;
-			this->MoveSceneItem(weak, sub_row, new_item);
-		}
+		this->FreeNode(node);
 	}
+
+	this->endRemoveRows();
+}
+
+void StvItemModel::RenumberRows(uint32_t parent, int first_row)
+{
+	const std::vector<uint32_t> &children = this->Folder(parent).Children;
+	for(size_t row = (size_t)first_row; row < children.size(); ++row)
+		this->_nodes[children[row]].Row = (uint32_t)row;
 }
 
-obs_data_array_t *StvItemModel::CreateFolderArray(QStandardItem &folder, QTreeView *view)
+void StvItemModel::SetNodeName(uint32_t node, const QString &name)
 {
-	obs_data_array_t *folder_data = obs_data_array_create();
+	if(this->NodeName(node) == name)
+		return;
+
+	this->_nodes[node].NameId = this->InternName(name);
 
-	for(int i=0; i < folder.rowCount(); ++i)
+	// Scenes are saved by UUID, renaming them doesn't change the tree
+	if(this->IsFolderNode(node))
 	{
-		QStandardItem *item = folder.child(i);
-		assert(item->type() == FOLDER || item->type() == SCENE);
+		if(StvFolderNames *folder_names = this->FindFolderNames(this->_nodes[node].Parent))
+			folder_names->RenameFolder(node, name);
 
-		OBSDataAutoRelease item_data = obs_data_create();
-		if(item->type() == FOLDER)
-		{
-			OBSDataArrayAutoRelease sub_folder_data = this->CreateFolderArray(*item, view);
-			obs_data_set_array(item_data, SCENE_TREE_CONFIG_FOLDER_DATA.data(), sub_folder_data);
-			obs_data_set_bool(item_data, SCENE_TREE_CONFIG_FOLDER_EXPANDED.data(), view->isExpanded(item->index()));
-			obs_data_set_string(item_data, SCENE_TREE_CONFIG_ITEM_NAME_DATA.data(), item->text().toStdString().c_str());
-		}
-		else
-		{
-			obs_weak_source_t *weak = item->data(QDATA_ROLE::OBS_SCENE).value<obs_weak_source_ptr>().ptr;
-			OBSSourceAutoRelease source = OBSGetStrongRef(weak);
-			obs_data_set_string(item_data, SCENE_TREE_CONFIG_ITEM_NAME_DATA.data(), obs_source_get_name(source));
-		}
+		this->RecordRename(this->_nodes[node].NodeId, name);
+	}
 
-		obs_data_array_push_back(folder_data, item_data);
+	const QModelIndex index = this->IndexFromNode(node);
+	emit this->dataChanged(index, index, {Qt::DisplayRole, Qt::EditRole});
+}
+
+const StvItemModel::scene_entry_t *StvItemModel::FindSceneEntry(obs_source_t *source) const
+{
+	if(const auto scene_it = this->_scenes_in_tree.find(source); scene_it != this->_scenes_in_tree.end() &&
+	        obs_weak_source_references_source(scene_it->second.Weak, source))
+		return &scene_it->second;
+
+	return nullptr;
+}
+
+obs_weak_source_t *StvItemModel::GetSceneSource(uint32_t node) const
+{
+	// Nodes of scenes whose entry was replaced by a new scene with the same source pointer have no source
+	if(const auto scene_it = this->_scenes_in_tree.find(this->_nodes[node].Source); scene_it != this->_scenes_in_tree.end() &&
+	        scene_it->second.Node == node)
+		return scene_it->second.Weak;
+
+	return nullptr;
+}
+
+void StvItemModel::AddSceneToIndex(obs_source_t *source, uint32_t node)
+{
+	// Remove the entry of a destroyed scene whose source pointer was reused
+	if(const auto scene_it = this->_scenes_in_tree.find(source); scene_it != this->_scenes_in_tree.end())
+		this->EraseSceneItem(scene_it);
+
+	this->_scenes_in_tree[source] = scene_entry_t{OBSGetWeakRef(source), node};
+}
+
+uint32_t StvItemModel::GetInsertParent(const QModelIndex &selected_index) const
+{
+	if(!selected_index.isValid())
+		return ROOT_NODE;
+
+	const uint32_t selected = this->NodeFromIndex(selected_index);
+	return this->IsFolderNode(selected) ? selected : this->_nodes[selected].Parent;
+}
+
+uint32_t StvItemModel::InsertSceneNode(obs_source_t *source, const QModelIndex &selected_index)
+{
+	const uint32_t parent = this->GetInsertParent(selected_index);
+	const uint32_t selected = selected_index.isValid() ? this->NodeFromIndex(selected_index) : parent;
+
+	// Keep the order of saved items, new scenes are inserted in front of them
+	this->FetchFolder(parent);
+
+	// The node refers to its scene before insertion, so that the recorded edit contains the scene's UUID
+	const uint32_t node = this->CreateSceneNode(source, QString::fromUtf8(obs_source_get_name(source)), 0);
+	this->InsertNodes(parent, parent == selected ? 0 : (int)this->_nodes[selected].Row, {node});
+
+	return node;
+}
+
+void StvItemModel::AddScene(obs_source_t *source, const OBSWeakSource &weak)
+{
+	if(!this->_track_scenes)
+		return;
+
+	OBSSource strong = OBSGetStrongRef(weak);
+	if(!strong || strong.Get() != source || obs_source_removed(source))
+		return;
+
+	if(this->FindSceneEntry(source) || !this->IsManagedScene(source))
+		return;
+
+	this->AddSceneToIndex(source, this->InsertSceneNode(source, this->_current_index));
+
+	emit this->SceneTreeChanged();
+}
+
+void StvItemModel::RemoveScene(obs_source_t *source, const OBSWeakSource &weak)
+{
+	// The source may already be destroyed, only compare pointers
+	const auto scene_it = this->_scenes_in_tree.find(source);
+	if(!this->_track_scenes || scene_it == this->_scenes_in_tree.end() || scene_it->second.Weak.Get() != weak.Get())
+		return;
+
+	this->EraseSceneItem(scene_it);
+
+	emit this->SceneTreeChanged();
+}
+
+void StvItemModel::EraseSceneItem(scene_index_t::iterator scene_it)
+{
+	const uint32_t node = scene_it->second.Node;
+
+	// Scenes in folders that weren't expanded yet have no node
+	if(node == INVALID_NODE)
+	{
+		this->RecordDelete(scene_it->second.PendingNodeId);
+		this->_scenes_in_tree.erase(scene_it);
+		return;
 	}
 
-	return folder_data;
+	this->_scenes_in_tree.erase(scene_it);
+	this->RemoveNodes(this->_nodes[node].Parent, (int)this->_nodes[node].Row, 1);
 }
 
-void StvItemModel::LoadFolderArray(obs_data_array_t *folder_data, QStandardItem &folder, std::list<StvFolderItem*> &expandable_folders)
+void StvItemModel::RenameScene(obs_source_t *source, const OBSWeakSource &weak, const QString &name)
+{
+	const auto scene_it = this->_scenes_in_tree.find(source);
+	if(!this->_track_scenes || scene_it == this->_scenes_in_tree.end() || scene_it->second.Weak.Get() != weak.Get())
+		return;
+
+	// Scenes are saved by UUID, only the displayed name changes. Scenes in folders that weren't
+	// expanded yet read the name of their source once their node is created
+	if(scene_it->second.Node != INVALID_NODE)
+		this->SetNodeName(scene_it->second.Node, name);
+}
+
+static inline obs_source_t *GetSignalScene(calldata_t *cd)
+{
+	// Groups are scenes as well, but they aren't part of the frontend's scene list
+	obs_source_t *source = (obs_source_t*)calldata_ptr(cd, "source");
+	if(!source || obs_source_get_type(source) != OBS_SOURCE_TYPE_SCENE || obs_source_is_group(source))
+		return nullptr;
+
+	return source;
+}
+
+void StvItemModel::obs_source_create_cb(void *private_data, calldata_t *cd)
+{
+	if(obs_source_t *source = GetSignalScene(cd))
+	{
+		StvItemModel *model = static_cast<StvItemModel*>(private_data);
+		QMetaObject::invokeMethod(model, [model, source, weak = OBSGetWeakRef(source)]() {
+			model->AddScene(source, weak);
+		}, Qt::QueuedConnection);
+	}
+}
+
+void StvItemModel::obs_source_remove_cb(void *private_data, calldata_t *cd)
+{
+	if(obs_source_t *source = GetSignalScene(cd))
+	{
+		StvItemModel *model = static_cast<StvItemModel*>(private_data);
+		QMetaObject::invokeMethod(model, [model, source, weak = OBSGetWeakRef(source)]() {
+			model->RemoveScene(source, weak);
+			model->ReleaseSceneSettings(source, weak);
+		}, Qt::QueuedConnection);
+	}
+}
+
+void StvItemModel::obs_source_rename_cb(void *private_data, calldata_t *cd)
+{
+	if(obs_source_t *source = GetSignalScene(cd))
+	{
+		StvItemModel *model = static_cast<StvItemModel*>(private_data);
+		QMetaObject::invokeMethod(model, [model, source, weak = OBSGetWeakRef(source),
+		                          name = QString::fromUtf8(calldata_string(cd, "new_name"))]() {
+			model->RenameScene(source, weak, name);
+		}, Qt::QueuedConnection);
+	}
+}
+
+void StvItemModel::obs_scene_update_cb(void *private_data, calldata_t *cd)
+{
+	obs_source_t *source = (obs_source_t*)calldata_ptr(cd, "source");
+
+	StvItemModel *model = static_cast<StvItemModel*>(private_data);
+	QMetaObject::invokeMethod(model, [model, source, weak = OBSGetWeakRef(source)]() {
+		model->UpdateSceneSettings(source, weak);
+	}, Qt::QueuedConnection);
+}
+
+bool StvItemModel::MoveNodes(uint32_t first, int count, int row, uint32_t parent)
+{
+	this->FetchFolder(parent);
+
+	const node_t &item = this->_nodes[first];
+	return this->moveRows(this->IndexFromNode(item.Parent), (int)item.Row, count, this->IndexFromNode(parent),
+	                      std::min(row, (int)this->Folder(parent).Children.size()));
+}
+
+std::vector<uint32_t> StvItemModel::ReadMimeItems(const QByteArray &mime_data) const
+{
+	QDataStream stream(mime_data);
+	quint32 num_items = 0;
+	stream >> num_items;
+
+	std::vector<uint64_t> node_ids;
+	std::unordered_map<uint64_t, uint32_t> id_nodes;
+	for(quint32 i = 0; i < num_items && stream.status() == QDataStream::Ok; ++i)
+	{
+		quint64 node_id = 0;
+		stream >> node_id;
+
+		node_ids.push_back(node_id);
+		id_nodes.emplace(node_id, INVALID_NODE);
+	}
+
+	// Node IDs aren't indexed, the dragged nodes are found in a single pass over the arena. Freed nodes have no ID
+	for(uint32_t node = 0; node < (uint32_t)this->_nodes.size(); ++node)
+	{
+		if(const auto id_it = id_nodes.find(this->_nodes[node].NodeId); node != ROOT_NODE && id_it != id_nodes.end())
+			id_it->second = node;
+	}
+
+	std::vector<uint32_t> nodes;
+	nodes.reserve(node_ids.size());
+	for(const uint64_t node_id : node_ids)
+	{
+		const uint32_t node = node_id ? id_nodes[node_id] : INVALID_NODE;
+		if(node != INVALID_NODE)
+			nodes.push_back(node);
+		else
+			blog(LOG_WARNING, "[%s] Couldn't find item to move in Scene Tree View", obs_module_name());
+	}
+
+	return nodes;
+}
+
+void StvItemModel::LoadFolderArray(obs_data_array_t *folder_data, load_context_t &context, std::vector<stv_pending_item_t> &folder_items)
 {
 	const size_t item_count = obs_data_array_count(folder_data);
 	for(size_t i=0; i < item_count; ++i)
@@ -520,61 +1402,371 @@ void StvItemModel::LoadFolderArray(obs_data_array_t *folder_data, QStandardItem
 		OBSDataAutoRelease item_data = obs_data_array_item(folder_data, i);
 
 		const char *item_name = obs_data_get_string(item_data, SCENE_TREE_CONFIG_ITEM_NAME_DATA.data());
+		const char *scene_uuid = obs_data_get_string(item_data, SCENE_TREE_CONFIG_SCENE_UUID_DATA.data());
 		OBSDataArrayAutoRelease folder_data = obs_data_get_array(item_data, SCENE_TREE_CONFIG_FOLDER_DATA.data());
 
+		// IDs missing in trees of previous versions are assigned after loading
+		const uint64_t node_id = (uint64_t)obs_data_get_int(item_data, SCENE_TREE_CONFIG_NODE_ID_DATA.data());
+
 		// Check if this is folder or scene item (only folders have folder_data)
 		if(!folder_data)
+			this->AddPendingScene(scene_uuid, item_name, node_id, context, folder_items);
+		else
 		{
-			// Add scene to folder, skip if scene doesn't exist anymore
-			OBSSceneAutoRelease scene = obs_get_scene_by_name(item_name);
-			if(!scene || !this->IsManagedScene(scene))
-				continue;
+			stv_pending_item_t folder_item{true, obs_data_get_bool(item_data, SCENE_TREE_CONFIG_FOLDER_EXPANDED.data()),
+			                               QString::fromUtf8(item_name), nullptr, {}, ClaimNodeId(node_id, context)};
+			this->LoadFolderArray(folder_data, context, folder_item.Children);
 
-			{
-				OBSSource source = obs_scene_get_source(scene);
-				OBSWeakSource weak = obs_source_get_weak_source(source);
+			folder_items.push_back(std::move(folder_item));
+		}
+	}
+}
 
-				// Skip if scene already in treeview
-				// (see issue https://github.com/DigitOtter/obs_scene_tree_view/issues/19)
-				if(this->_scenes_in_tree.find(weak) != this->_scenes_in_tree.end())
-				{
-					obs_weak_source_release(weak);
-					continue;
-				}
+void StvItemModel::LoadImageNodes(const StvTreeImage &tree_image, uint32_t first, uint32_t end, load_context_t &context,
+                                  std::vector<stv_pending_item_t> &folder_items)
+{
+	// Names are read from the mapped file, only folder names are copied
+	for(uint32_t i = first; i < end; i = tree_image.Node(i).SubtreeEnd)
+	{
+		const StvTreeImage::node_t &node = tree_image.Node(i);
+		const std::string_view node_name = tree_image.NodeName(node);
 
-				StvSceneItem *new_scene_item = new StvSceneItem(item_name, weak);
-				folder.appendRow(new_scene_item);
+		if(!(node.Flags & StvTreeImage::FOLDER_FLAG))
+			this->AddPendingScene(tree_image.NodeUuid(node), node_name, node.NodeId, context, folder_items);
+		else
+		{
+			stv_pending_item_t folder_item{true, (node.Flags & StvTreeImage::EXPANDED_FLAG) != 0,
+			                               QString::fromUtf8(node_name.data(), (qsizetype)node_name.size()), nullptr, {},
+			                               ClaimNodeId(node.NodeId, context)};
+			this->LoadImageNodes(tree_image, i + 1, node.SubtreeEnd, context, folder_item.Children);
 
-				this->_scenes_in_tree.emplace(weak, new_scene_item);
-			}
+			folder_items.push_back(std::move(folder_item));
+		}
+	}
+}
+
+void StvItemModel::AddPendingScene(std::string_view scene_uuid, std::string_view scene_name, uint64_t node_id, load_context_t &context,
+                                   std::vector<stv_pending_item_t> &folder_items)
+{
+	// Add scene to folder, skip if scene doesn't exist anymore. Scenes saved without UUID, or whose UUID changed
+	// because the collection was imported, are found by name
+	obs_source_t *source = nullptr;
+	if(const auto uuid_it = context.UuidTable.find(scene_uuid); !scene_uuid.empty() && uuid_it != context.UuidTable.end())
+		source = uuid_it->second;
+	else if(const auto scene_it = context.SceneTable.find(scene_name); scene_it != context.SceneTable.end())
+	{
+		source = scene_it->second;
+		++context.ResolvedByName;
+	}
+
+	// Skip if scene already in treeview
+	// (see issue https://github.com/DigitOtter/obs_scene_tree_view/issues/19)
+	if(!source || this->_scenes_in_tree.find(source) != this->_scenes_in_tree.end() || !this->IsManagedScene(source))
+	{
+		++context.SkippedScenes;
+		return;
+	}
+
+	// The node is created once the folder is visible
+	this->_scenes_in_tree.emplace(source, scene_entry_t{OBSGetWeakRef(source)});
+	folder_items.push_back(stv_pending_item_t{false, false, QString(), source, {}, ClaimNodeId(node_id, context)});
+}
+
+uint64_t StvItemModel::ClaimNodeId(uint64_t node_id, load_context_t &context)
+{
+	// Duplicate IDs are replaced after loading
+	if(node_id && !context.NodeIds.insert(node_id).second)
+		return 0;
+
+	return node_id;
+}
+
+void StvItemModel::AssignNodeIds(std::vector<stv_pending_item_t> &folder_items)
+{
+	for(auto &folder_item : folder_items)
+	{
+		if(!folder_item.NodeId)
+			folder_item.NodeId = ++this->_next_node_id;
+
+		// Scene items are created from their index entry
+		if(folder_item.IsFolder)
+			this->AssignNodeIds(folder_item.Children);
+		else if(const auto scene_it = this->_scenes_in_tree.find(folder_item.Source); scene_it != this->_scenes_in_tree.end())
+			scene_it->second.PendingNodeId = folder_item.NodeId;
+	}
+}
+
+void StvItemModel::CaptureFolder(uint32_t folder, StvTreeSnapshot &snapshot)
+{
+	for(const uint32_t node : this->Folder(folder).Children)
+	{
+		if(this->IsFolderNode(node))
+		{
+			snapshot.BeginFolder(this->NodeName(node).toUtf8().constData(), this->_nodes[node].NodeId, this->Folder(node).IsExpanded);
+			this->CaptureFolder(node, snapshot);
+			snapshot.EndFolder();
 		}
 		else
 		{
-			StvFolderItem *new_folder_item = new StvFolderItem(item_name);
-			this->LoadFolderArray(folder_data, *new_folder_item, expandable_folders);
+			if(OBSSource source = OBSGetStrongRef(this->GetSceneSource(node)))
+				snapshot.AddScene(obs_source_get_name(source), obs_source_get_uuid(source), this->_nodes[node].NodeId);
+		}
+	}
 
-			folder.appendRow(new_folder_item);
+	this->CapturePendingItems(this->Folder(folder).PendingChildren, snapshot);
+}
 
-			// Check if folder should be expanded.
-			// The folders are expanded after the tree is completely created to prevent new inserts from closing the folders again
-			if(obs_data_get_bool(item_data, SCENE_TREE_CONFIG_FOLDER_EXPANDED.data()))
-				expandable_folders.push_back(new_folder_item);
+void StvItemModel::CapturePendingItems(const std::vector<stv_pending_item_t> &pending_items, StvTreeSnapshot &snapshot)
+{
+	for(const auto &pending_item : pending_items)
+	{
+		if(pending_item.IsFolder)
+		{
+			snapshot.BeginFolder(pending_item.Name.toUtf8().constData(), pending_item.NodeId, pending_item.IsExpanded);
+			this->CapturePendingItems(pending_item.Children, snapshot);
+			snapshot.EndFolder();
+			continue;
 		}
+
+		// Skip scenes that were removed while their folder was pending
+		const auto scene_it = this->_scenes_in_tree.find(pending_item.Source);
+		if(scene_it == this->_scenes_in_tree.end() || scene_it->second.Node != INVALID_NODE)
+			continue;
+
+		if(OBSSource source = OBSGetStrongRef(scene_it->second.Weak))
+			snapshot.AddScene(obs_source_get_name(source), obs_source_get_uuid(source), pending_item.NodeId);
 	}
 }
 
-void StvItemModel::SetIcon(const QIcon &icon, QITEM_TYPE item_type, QStandardItem *item)
+size_t StvItemModel::CountTreeScenes(uint32_t folder) const
 {
-	if(!item)
+	size_t scene_count = 0;
+	for(const uint32_t node : this->Folder(folder).Children)
+	{
+		if(this->IsFolderNode(node))
+			scene_count += this->CountTreeScenes(node);
+		else if(this->GetSceneSource(node))
+			++scene_count;
+	}
+
+	return scene_count + this->CountPendingScenes(this->Folder(folder).PendingChildren);
+}
+
+size_t StvItemModel::CountPendingScenes(const std::vector<stv_pending_item_t> &pending_items) const
+{
+	size_t scene_count = 0;
+	for(const auto &pending_item : pending_items)
+	{
+		if(pending_item.IsFolder)
+			scene_count += this->CountPendingScenes(pending_item.Children);
+		else if(const auto scene_it = this->_scenes_in_tree.find(pending_item.Source);
+		        scene_it != this->_scenes_in_tree.end() && scene_it->second.Node == INVALID_NODE)
+			++scene_count;
+	}
+
+	return scene_count;
+}
+
+std::vector<uint32_t> StvItemModel::CreateFolderNodes(std::vector<stv_pending_item_t> &&folder_items, bool create_expanded)
+{
+	std::vector<uint32_t> nodes;
+	nodes.reserve(folder_items.size());
+
+	for(auto &folder_item : folder_items)
+	{
+		if(folder_item.IsFolder)
+		{
+			const uint32_t folder = this->CreateFolderNode(folder_item.Name, folder_item.NodeId, folder_item.IsExpanded);
+
+			// While loading, expanded folders are created right away. Views expand them once the model was reset
+			if(create_expanded && folder_item.IsExpanded)
+				this->AttachNodes(folder, 0, this->CreateFolderNodes(std::move(folder_item.Children), create_expanded));
+			else
+			{
+				this->SetPendingFolder(folder_item.Children, folder);
+				this->Folder(folder).PendingChildren = std::move(folder_item.Children);
+			}
+
+			nodes.push_back(folder);
+		}
+		else if(const uint32_t scene = this->CreatePendingSceneNode(folder_item.Source); scene != INVALID_NODE)
+			nodes.push_back(scene);
+	}
+
+	return nodes;
+}
+
+uint32_t StvItemModel::CreatePendingSceneNode(obs_source_t *source)
+{
+	// Skip scenes that were removed while their folder was pending. If the source pointer was reused
+	// by a new scene, its entry already has a node
+	const auto scene_it = this->_scenes_in_tree.find(source);
+	if(scene_it == this->_scenes_in_tree.end() || scene_it->second.Node != INVALID_NODE)
+		return INVALID_NODE;
+
+	OBSSource strong = OBSGetStrongRef(scene_it->second.Weak);
+	if(!strong)
+		return INVALID_NODE;
+
+	const uint32_t node = this->CreateSceneNode(source, QString::fromUtf8(obs_source_get_name(strong)), scene_it->second.PendingNodeId);
+	scene_it->second.Node = node;
+	scene_it->second.PendingFolder = INVALID_NODE;
+
+	return node;
+}
+
+void StvItemModel::SetPendingFolder(const std::vector<stv_pending_item_t> &pending_items, uint32_t folder)
+{
+	for(const auto &pending_item : pending_items)
+	{
+		if(pending_item.IsFolder)
+			this->SetPendingFolder(pending_item.Children, folder);
+		else if(const auto scene_it = this->_scenes_in_tree.find(pending_item.Source);
+		        scene_it != this->_scenes_in_tree.end() && scene_it->second.Node == INVALID_NODE)
+			scene_it->second.PendingFolder = folder;
+	}
+}
+
+void StvItemModel::FetchFolder(uint32_t folder)
+{
+	if(!this->HasPendingChildren(folder))
+		return;
+
+	// Sub folders stay pending until they are expanded themselves. Creating the nodes isn't an edit
+	std::vector<stv_pending_item_t> pending_items = std::move(this->Folder(folder).PendingChildren);
+	this->Folder(folder).PendingChildren.clear();
+
+	const std::vector<uint32_t> nodes = this->CreateFolderNodes(std::move(pending_items), false);
+	if(nodes.empty())
+		return;
+
+	const int row = (int)this->Folder(folder).Children.size();
+	this->beginInsertRows(this->IndexFromNode(folder), row, row + (int)nodes.size() - 1);
+	this->AttachNodes(folder, row, nodes);
+	this->endInsertRows();
+}
+
+void StvItemModel::SetRecordEdits(bool record_edits)
+{
+	this->_record_edits = record_edits;
+}
+
+bool StvItemModel::IsRecordingEdits() const
+{
+	return this->_record_edits;
+}
+
+OBSDataAutoRelease StvItemModel::CreateEditRecord(std::string_view operation, uint64_t node_id) const
+{
+	OBSDataAutoRelease edit_record = obs_data_create();
+	obs_data_set_string(edit_record, TREE_EDIT_OPERATION.data(), operation.data());
+	obs_data_set_int(edit_record, SCENE_TREE_CONFIG_NODE_ID_DATA.data(), (long long)node_id);
+
+	return edit_record;
+}
+
+void StvItemModel::RecordInsertedNode(uint32_t node)
+{
+	if(!this->IsRecordingEdits())
 		return;
 
-	for(int i=0; i < item->rowCount(); ++i)
+	// New folders are empty, moved nodes are recorded by moveRows()
+	const node_t &item = this->_nodes[node];
+	OBSDataAutoRelease edit_record = this->CreateEditRecord(TREE_EDIT_CREATE, item.NodeId);
+	obs_data_set_int(edit_record, TREE_EDIT_PARENT.data(), (long long)this->_nodes[item.Parent].NodeId);
+	obs_data_set_int(edit_record, TREE_EDIT_ROW.data(), (long long)item.Row);
+	obs_data_set_bool(edit_record, TREE_EDIT_IS_FOLDER.data(), this->IsFolderNode(node));
+	obs_data_set_string(edit_record, SCENE_TREE_CONFIG_ITEM_NAME_DATA.data(), this->NodeName(node).toUtf8().constData());
+	if(item.Source)
+		obs_data_set_string(edit_record, SCENE_TREE_CONFIG_SCENE_UUID_DATA.data(), obs_source_get_uuid(item.Source));
+
+	emit this->TreeEdited(OBSData(edit_record.Get()));
+}
+
+void StvItemModel::RecordMovedNodes(uint32_t parent, const std::vector<uint32_t> &nodes, int row)
+{
+	if(!this->IsRecordingEdits())
+		return;
+
+	// Like moveRows(), a replay takes out all nodes before inserting them at the row
+	OBSDataArrayAutoRelease moved_items = obs_data_array_create();
+	for(const uint32_t node : nodes)
 	{
-		QStandardItem *child = item->child(i);
-		if(child->type() == item_type)
-			child->setIcon(icon);
+		OBSDataAutoRelease moved_item = obs_data_create();
+		obs_data_set_int(moved_item, SCENE_TREE_CONFIG_NODE_ID_DATA.data(), (long long)this->_nodes[node].NodeId);
+		obs_data_array_push_back(moved_items, moved_item);
+	}
+
+	OBSDataAutoRelease edit_record = this->CreateEditRecord(TREE_EDIT_MOVE, 0);
+	obs_data_set_array(edit_record, TREE_EDIT_ITEMS.data(), moved_items);
+	obs_data_set_int(edit_record, TREE_EDIT_PARENT.data(), (long long)this->_nodes[parent].NodeId);
+	obs_data_set_int(edit_record, TREE_EDIT_ROW.data(), row);
+
+	emit this->TreeEdited(OBSData(edit_record.Get()));
+}
+
+void StvItemModel::RecordRename(uint64_t node_id, const QString &name)
+{
+	if(!this->IsRecordingEdits())
+		return;
+
+	OBSDataAutoRelease edit_record = this->CreateEditRecord(TREE_EDIT_RENAME, node_id);
+	obs_data_set_string(edit_record, SCENE_TREE_CONFIG_ITEM_NAME_DATA.data(), name.toUtf8().constData());
+
+	emit this->TreeEdited(OBSData(edit_record.Get()));
+}
+
+void StvItemModel::RecordDelete(uint64_t node_id)
+{
+	if(!this->IsRecordingEdits())
+		return;
+
+	OBSDataAutoRelease edit_record = this->CreateEditRecord(TREE_EDIT_DELETE, node_id);
+	emit this->TreeEdited(OBSData(edit_record.Get()));
+}
+
+bool StvItemModel::IsFolderExpanded(const QModelIndex &index) const
+{
+	const uint32_t node = this->NodeFromIndex(index);
+	return index.isValid() && this->IsFolderNode(node) && this->Folder(node).IsExpanded;
+}
+
+void StvItemModel::SetFolderExpanded(const QModelIndex &index, bool expanded)
+{
+	const uint32_t node = this->NodeFromIndex(index);
+	if(!index.isValid() || !this->IsFolderNode(node))
+		return;
+
+	folder_t &folder = this->Folder(node);
+	if(folder.IsExpanded == expanded)
+		return;
+
+	folder.IsExpanded = expanded;
+
+	if(this->IsRecordingEdits())
+	{
+		OBSDataAutoRelease edit_record = this->CreateEditRecord(TREE_EDIT_EXPAND, this->_nodes[node].NodeId);
+		obs_data_set_bool(edit_record, SCENE_TREE_CONFIG_FOLDER_EXPANDED.data(), expanded);
+
+		emit this->TreeEdited(OBSData(edit_record.Get()));
+	}
+
+	// The expansion state is saved with the tree
+	emit this->SceneTreeChanged();
+}
+
+void StvItemModel::RefreshIcons()
+{
+	// Only the decoration changes. Each folder reports the rows of its created children, freed nodes aren't folders
+	for(uint32_t node = 0; node < (uint32_t)this->_nodes.size(); ++node)
+	{
+		if(!this->IsFolderNode(node))
+			continue;
+
+		const std::vector<uint32_t> &children = this->Folder(node).Children;
+		if(children.empty())
+			continue;
 
-		if(child->type() == FOLDER)
-			this->SetIcon(icon, item_type, child);
+		emit this->dataChanged(this->IndexFromNode(children.front()), this->IndexFromNode(children.back()), {Qt::DecorationRole});
 	}
 }
@@ -5,13 +5,21 @@
 #include <obs-module.h>
 #include <obs-frontend-api.h>
 
-#include <QStandardItemModel>
-#include <QTreeView>
+#include <QAbstractItemModel>
+#include <QIcon>
 #include <QtWidgets/QMainWindow>
 
+#include <cstdint>
+#include <functional>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 
+class StvTreeImage;
+class StvTreeSnapshot;
+
 struct obs_weak_source_ptr
 {
 		obs_weak_source_t *ptr;
@@ -19,27 +27,60 @@ struct obs_weak_source_ptr
 
 Q_DECLARE_METATYPE(obs_weak_source_ptr);
 
-class StvFolderItem
-        : public QStandardItem
+// Names of the folders inside a folder. The index is built on first use and kept up to date by the model,
+// so unique names can be checked and generated without scanning all siblings. Folders are identified by their node
+class StvFolderNames
 {
 	public:
-		StvFolderItem(const QString &text);
-		virtual ~StvFolderItem() override = default;
-		int type() const override;
+		bool IsIndexed() const;
+		void SetIndexed();
+		void Clear();
+
+		bool IsUnique(const QString &name, uint32_t node_to_skip = UINT32_MAX) const;
+
+		// format must contain a %1 placeholder, which is replaced by the lowest free number
+		QString CreateUniqueName(const QString &format, uint32_t node_to_skip = UINT32_MAX);
+
+		void AddFolder(uint32_t node, const QString &name);
+		void RemoveFolder(uint32_t node);
+		void RenameFolder(uint32_t node, const QString &name);
+
+	private:
+		struct name_format_t
+		{
+			QString Prefix;
+			QString Suffix;
+			int NextNumber;
+		};
+
+		bool _is_indexed = false;
+		std::unordered_map<uint32_t, QString> _folders;
+		std::unordered_map<QString, int> _name_counts;
+
+		// Numbers below NextNumber are known to be taken, so name generation resumes from there
+		std::unordered_map<QString, name_format_t> _formats;
+
+		void AddName(const QString &name);
+		void RemoveName(const QString &name);
 };
 
-class StvSceneItem
-        : public QStandardItem
+// Saved item of a folder that wasn't expanded yet. Nodes are only created once the folder's children are requested
+struct stv_pending_item_t
 {
-	public:
-		StvSceneItem(const QString &text, obs_weak_source_t *weak);
-		virtual ~StvSceneItem() override = default;
-		int type() const override;
+	bool IsFolder;
+	bool IsExpanded;
+	QString Name;					// Folder name, scenes use the name of their source
+	obs_source_t *Source;			// Scene, key into the model's scene index
+	std::vector<stv_pending_item_t> Children;
+	uint64_t NodeId = 0;
 };
 
 
+// Folders and scenes are stored as nodes of a single arena and addressed by their node index, which is
+// also the internal ID of their model indexes. Names are interned, the icon and scene role are answered
+// on demand from the model's icons and scene index
 class StvItemModel
-        : public QStandardItemModel
+        : public QAbstractItemModel
 {
 		Q_OBJECT
 
@@ -49,76 +90,293 @@ class StvItemModel
 		};
 
 		static constexpr std::string_view MIME_TYPE = "application/x-stvindexlist";
+
+	public:
 		static constexpr std::string_view SCENE_TREE_CONFIG_FOLDER_DATA = "folder";
 		static constexpr std::string_view SCENE_TREE_CONFIG_FOLDER_EXPANDED = "is_expanded";
 		static constexpr std::string_view SCENE_TREE_CONFIG_ITEM_NAME_DATA = "name";
+		static constexpr std::string_view SCENE_TREE_CONFIG_NODE_ID_DATA = "id";
+
+		// Scenes are saved by the UUID of their source, the name is only kept to resolve trees of previous versions
+		static constexpr std::string_view SCENE_TREE_CONFIG_SCENE_UUID_DATA = "uuid";
+
+		// Recorded tree edits. Items are identified by their node ID, the root folder has ID 0
+		static constexpr std::string_view TREE_EDIT_OPERATION = "op";
+		static constexpr std::string_view TREE_EDIT_PARENT = "parent";
+		static constexpr std::string_view TREE_EDIT_ROW = "row";
+		static constexpr std::string_view TREE_EDIT_IS_FOLDER = "is_folder";
+		static constexpr std::string_view TREE_EDIT_ITEMS = "items";
+		static constexpr std::string_view TREE_EDIT_CREATE = "create";
+		static constexpr std::string_view TREE_EDIT_MOVE = "move";
+		static constexpr std::string_view TREE_EDIT_RENAME = "rename";
+		static constexpr std::string_view TREE_EDIT_DELETE = "delete";
+		static constexpr std::string_view TREE_EDIT_EXPAND = "expand";
 
-	public:
 		enum QDATA_ROLE
 		{	OBS_SCENE = Qt::UserRole	};
 
 		enum QITEM_TYPE
-		{	FOLDER = QStandardItem::UserType+1, SCENE	};
+		{	FOLDER = 1, SCENE	};
 
 		StvItemModel();
 		virtual ~StvItemModel() override;
 
+		QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+		QModelIndex parent(const QModelIndex &child) const override;
+		int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+		int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+		QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+		bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
+		Qt::ItemFlags flags(const QModelIndex &index) const override;
+
 		QStringList mimeTypes() const override;
 		QMimeData *mimeData(const QModelIndexList &indexes) const override;
 		bool dropMimeData(const QMimeData *data, Qt::DropAction action, int row, int column, const QModelIndex &parent) override;
+		Qt::DropActions supportedDropActions() const override;
+
+		// Folder contents are created when a view expands the folder
+		bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+		bool canFetchMore(const QModelIndex &parent) const override;
+		void fetchMore(const QModelIndex &parent) override;
+		bool moveRows(const QModelIndex &sourceParent, int sourceRow, int count, const QModelIndex &destinationParent, int destinationChild) override;
+		bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex()) override;
+
+		bool IsFolder(const QModelIndex &index) const;
+		bool IsScene(const QModelIndex &index) const;
 
-		void UpdateTree(obs_frontend_source_list &scene_list, const QModelIndex &selected_index);
+		// Returns true if scenes were added to or removed from the tree
+		bool UpdateTree(obs_frontend_source_list &scene_list, const QModelIndex &selected_index);
+		void SetCurrentIndex(const QModelIndex &index);
 
-		bool CheckFolderNameUniqueness(const QString &name, QStandardItem *parent, QStandardItem *item_to_skip = nullptr);
+		bool CheckFolderNameUniqueness(const QString &name, const QModelIndex &parent, const QModelIndex &index_to_skip = QModelIndex());
+		QModelIndex InsertFolder(const QModelIndex &parent, int row, const QString &name);
 
-		void SetSelectedScene(QStandardItem *item, bool set_preview_scene, bool force_set_scene = false);
-		QStandardItem *GetCurrentSceneItem();
+		void SetSelectedScene(const QModelIndex &index, bool set_preview_scene, bool force_set_scene = false);
+		QModelIndex GetCurrentSceneIndex();
 		OBSSourceAutoRelease GetCurrentScene();
 
-		void SaveSceneTree(obs_data_t *root_folder_data, const char *scene_collection, QTreeView *view);
-		void LoadSceneTree(obs_data_t *root_folder_data, const char *scene_collection, QTreeView *view);
-		void CleanupSceneTree();
+		obs_weak_source_t *GetSceneSource(const QModelIndex &index) const;
 
-		QStandardItem *GetParentOrRoot(const QModelIndex &index);
+		// Captures the tree for saving, the snapshot is written without accessing the model
+		// Folders keep their expansion state, views restore it after the model was reset
+		void CaptureSceneTree(StvTreeSnapshot &snapshot);
+		void LoadSceneTree(obs_data_t *root_folder_data, const char *scene_collection);
+		void LoadSceneTree(const StvTreeImage &tree_image);
+		void CleanupSceneTree();
 
-		QString CreateUniqueFolderName(QStandardItem *folder_item, QStandardItem *parent);
+		QString CreateFolderName(const QString &format, const QModelIndex &parent);
 
+		void UpdateIcons();
 		void SetIconVisibility(bool enable_visibility, QITEM_TYPE item_type);
-		void SetSceneIconVisibility(bool enable_visibility);
-		void SetFolderIconVisibility(bool enable_visibility);
+
+		// Report every tree edit via TreeEdited()
+		void SetRecordEdits(bool record_edits);
+
+		// Expansion state survives the folder being moved
+		bool IsFolderExpanded(const QModelIndex &index) const;
+		void SetFolderExpanded(const QModelIndex &index, bool expanded);
+
+		// True if scenes of the last loaded tree had to be found by name or were skipped, or items had no node ID yet.
+		// The tree should be saved again then
+		bool IsTreeOutdated() const
+		{	return this->_tree_outdated;	}
 
 		void UpdateSceneSize();
-		bool IsManagedScene(obs_scene_t *scene) const;
-		bool IsManagedScene(obs_source_t *scene_source) const;
+		bool IsManagedScene(obs_scene_t *scene);
+		bool IsManagedScene(obs_source_t *scene_source);
 
 
 			bool MoveIndexByOne(const QModelIndex &index, int delta);
 
+	signals:
+		void SceneTreeChanged();
+		void TreeEdited(const OBSData &operation);
+
 	private:
-		struct mime_item_data_t
+		static constexpr uint32_t INVALID_NODE = UINT32_MAX;
+		static constexpr uint32_t ROOT_NODE = 0;
+
+		struct node_t
+		{
+			uint32_t Parent = INVALID_NODE;
+			uint32_t Row = 0;
+			uint32_t NameId = 0;
+			uint32_t Folder = INVALID_NODE;		// Folder data of folder nodes
+			obs_source_t *Source = nullptr;		// Scene nodes, key into the scene index
+			uint64_t NodeId = 0;
+		};
+
+		// Children are kept as node indexes in row order, so that index() and parent() don't walk sibling chains
+		struct folder_t
+		{
+			std::vector<uint32_t> Children;
+			std::vector<stv_pending_item_t> PendingChildren;
+			StvFolderNames ChildNames;
+			bool IsExpanded = false;
+		};
+
+		// Freed nodes and folders are reused by the next created ones. Node 0 is the root folder
+		std::vector<node_t> _nodes;
+		std::vector<folder_t> _folders;
+		std::vector<uint32_t> _free_nodes;
+		std::vector<uint32_t> _free_folders;
+
+		// Nodes of the same name share one string. Names are only released when the tree is reset
+		std::vector<QString> _names;
+		std::unordered_map<QString, uint32_t> _name_ids;
+
+		struct scene_entry_t
+		{
+			OBSWeakSource Weak;
+			uint32_t Node = INVALID_NODE;
+			uint32_t PendingFolder = INVALID_NODE;		// Closest created folder if the scene has no node yet
+			uint64_t PendingNodeId = 0;
+		};
+
+		// Scenes are keyed by the source pointer captured on insertion. The weak reference is only used
+		// to verify that the pointer wasn't reused by a new source after the indexed one was destroyed
+		using scene_index_t = std::unordered_map<obs_source_t*, scene_entry_t>;
+
+		scene_index_t _scenes_in_tree;
+
+		// Scenes created, removed or renamed while the tree is loaded are applied incrementally
+		bool _track_scenes = false;
+		QPersistentModelIndex _current_index;
+
+		SCENE_SIZE_T _scene_size = {0, 0};
+
+		struct scene_settings_t
 		{
-			QITEM_TYPE Type;
-			void *Data;			// Either QStandardItem* (if Type == FOLDER) or obs_weak_source_t* (if Type == SCENE)
+			OBSWeakSource Weak;
+			bool CustomSize;
+			SCENE_SIZE_T Size;
 		};
 
-		struct SceneComp
+		// Size settings of every scene checked by IsManagedScene(), refreshed by the scene's update signal
+		using scene_settings_map_t = std::unordered_map<obs_source_t*, scene_settings_t>;
+
+		scene_settings_map_t _scene_settings;
+
+		// Dragged nodes are identified by their node ID, which they keep while they're moved
+		std::vector<uint32_t> ReadMimeItems(const QByteArray &mime_data) const;
+
+		// Nodes keep their node ID while they're moved. IDs are saved, so that recorded edits can be applied to saved trees
+		bool _record_edits = false;
+		uint64_t _next_node_id = 0;
+
+		bool _tree_outdated = false;
+
+		uint32_t NodeFromIndex(const QModelIndex &index) const;
+		QModelIndex IndexFromNode(uint32_t node) const;
+		bool IsFolderNode(uint32_t node) const;
+		bool HasPendingChildren(uint32_t node) const;
+		folder_t &Folder(uint32_t node);
+		const folder_t &Folder(uint32_t node) const;
+		const QString &NodeName(uint32_t node) const;
+		uint32_t InternName(const QString &name);
+
+		void ResetNodes();
+		uint32_t CreateNode();
+		uint32_t CreateFolderNode(const QString &name, uint64_t node_id, bool expanded);
+		uint32_t CreateSceneNode(obs_source_t *source, const QString &name, uint64_t node_id);
+		void FreeNode(uint32_t node);
+		void ErasePendingScenes(const std::vector<stv_pending_item_t> &pending_items);
+
+		// AttachNodes() only links the nodes, InsertNodes() and RemoveNodes() notify views and record the edit
+		void AttachNodes(uint32_t parent, int row, const std::vector<uint32_t> &nodes);
+		void InsertNodes(uint32_t parent, int row, const std::vector<uint32_t> &nodes);
+		void RemoveNodes(uint32_t parent, int row, int count);
+		void RenumberRows(uint32_t parent, int first_row);
+		void SetNodeName(uint32_t node, const QString &name);
+
+		bool IsRecordingEdits() const;
+		OBSDataAutoRelease CreateEditRecord(std::string_view operation, uint64_t node_id) const;
+		void RecordInsertedNode(uint32_t node);
+		void RecordMovedNodes(uint32_t parent, const std::vector<uint32_t> &nodes, int row);
+		void RecordRename(uint64_t node_id, const QString &name);
+		void RecordDelete(uint64_t node_id);
+
+		StvFolderNames &GetFolderNames(uint32_t parent);
+		StvFolderNames *FindFolderNames(uint32_t parent);
+		// Returns the name, or a numbered variant of it if a sibling of the folder is already named like that
+		QString CreateUniqueFolderName(uint32_t folder, QString folder_name);
+
+		bool ReadSceneSize();
+		bool IsManagedSize(const scene_settings_t &settings) const;
+		void ReadSceneSettings(obs_source_t *scene_source, scene_settings_t &settings);
+		void UpdateSceneSettings(obs_source_t *source, const OBSWeakSource &weak);
+		void ReleaseSceneSettings(obs_source_t *source, const OBSWeakSource &weak);
+		void ClearSceneSettings();
+
+		bool ApplyManagedState(obs_source_t *source);
+		void ReevaluateManagedScenes();
+
+		const scene_entry_t *FindSceneEntry(obs_source_t *source) const;
+		obs_weak_source_t *GetSceneSource(uint32_t node) const;
+		void AddSceneToIndex(obs_source_t *source, uint32_t node);
+		uint32_t GetInsertParent(const QModelIndex &selected_index) const;
+		uint32_t InsertSceneNode(obs_source_t *source, const QModelIndex &selected_index);
+
+		void AddScene(obs_source_t *source, const OBSWeakSource &weak);
+		void RemoveScene(obs_source_t *source, const OBSWeakSource &weak);
+		void RenameScene(obs_source_t *source, const OBSWeakSource &weak, const QString &name);
+		void EraseSceneItem(scene_index_t::iterator scene_it);
+
+		static void obs_source_create_cb(void *private_data, calldata_t *cd);
+		static void obs_source_remove_cb(void *private_data, calldata_t *cd);
+		static void obs_source_rename_cb(void *private_data, calldata_t *cd);
+		static void obs_scene_update_cb(void *private_data, calldata_t *cd);
+
+		// Moves count adjacent siblings, starting with the first node
+		bool MoveNodes(uint32_t first, int count, int row, uint32_t parent);
+
+		struct load_context_t
 		{
-			bool operator() (obs_weak_source_t *x, obs_weak_source_t *y) const
-			{	return OBSGetStrongRef(x).Get() < OBSGetStrongRef(y).Get();	}
+			// Scenes of the frontend's scene list by UUID and by name, used to resolve saved scenes while loading
+			std::unordered_map<std::string_view, obs_source_t*> UuidTable;
+			std::unordered_map<std::string_view, obs_source_t*> SceneTable;
+			std::unordered_set<uint64_t> NodeIds;
+			size_t ResolvedByName = 0;
+
+			// Saved scenes that aren't part of the loaded tree. Rows of the saved tree don't match the model then
+			size_t SkippedScenes = 0;
 		};
-		using source_map_t = std::map<obs_weak_source_t*, QStandardItem*, SceneComp>;
 
-		source_map_t _scenes_in_tree;
+		// Reads the saved items of a tree, the nodes of the model are then created the same way for all formats
+		using read_items_t = std::function<void(load_context_t&, std::vector<stv_pending_item_t>&)>;
+		void LoadItems(const read_items_t &read_items);
 
-		SCENE_SIZE_T _scene_size;
+		void LoadFolderArray(obs_data_array_t *folder_data, load_context_t &context, std::vector<stv_pending_item_t> &folder_items);
+		void LoadImageNodes(const StvTreeImage &tree_image, uint32_t first, uint32_t end, load_context_t &context,
+		                    std::vector<stv_pending_item_t> &folder_items);
+		void AddPendingScene(std::string_view scene_uuid, std::string_view scene_name, uint64_t node_id, load_context_t &context,
+		                     std::vector<stv_pending_item_t> &folder_items);
+		static uint64_t ClaimNodeId(uint64_t node_id, load_context_t &context);
+		void AssignNodeIds(std::vector<stv_pending_item_t> &folder_items);
 
-		void MoveSceneItem(obs_weak_source_t *source, int row, QStandardItem *parent_item);
-		void MoveSceneFolder(QStandardItem *item, int row, QStandardItem *parent_item);
+		void CaptureFolder(uint32_t folder, StvTreeSnapshot &snapshot);
+		void CapturePendingItems(const std::vector<stv_pending_item_t> &pending_items, StvTreeSnapshot &snapshot);
+
+		// Scenes of the tree, including the scenes of folders that weren't expanded yet
+		size_t CountTreeScenes(uint32_t folder) const;
+		size_t CountPendingScenes(const std::vector<stv_pending_item_t> &pending_items) const;
+
+		std::vector<uint32_t> CreateFolderNodes(std::vector<stv_pending_item_t> &&folder_items, bool create_expanded);
+		uint32_t CreatePendingSceneNode(obs_source_t *source);
+		void SetPendingFolder(const std::vector<stv_pending_item_t> &pending_items, uint32_t folder);
+		void FetchFolder(uint32_t folder);
+
+		struct item_icon_t
+		{
+			QIcon Icon;
+			bool Visible = false;
+		};
 
-		obs_data_array_t *CreateFolderArray(QStandardItem &folder, QTreeView *view);
-		void LoadFolderArray(obs_data_array_t *folder_data, QStandardItem &folder, std::list<StvFolderItem *> &expandable_folders);
+		// Icons are shared by all nodes of a type and served by data(), nodes don't store their own
+		item_icon_t _scene_icon;
+		item_icon_t _folder_icon;
 
-		void SetIcon(const QIcon &icon, QITEM_TYPE item_type, QStandardItem *item);
+		void RefreshIcons();
 };
 
 // Use OBS locale for translation
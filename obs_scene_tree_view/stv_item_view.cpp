@@ -1,29 +1,139 @@
 #include "obs_scene_tree_view/stv_item_view.h"
 
+#include <QKeyEvent>
 #include <QMouseEvent>
 #include <util/config-file.h>
 
+#include <algorithm>
+
 
 StvItemView::StvItemView(QWidget *parent)
     : QTreeView(parent)
-{}
+{
+	// Keep the folders' expansion state in sync, so that it can be restored after a folder was moved
+	QObject::connect(this, &QTreeView::expanded, this, [this](const QModelIndex &index) { this->SetFolderExpanded(index, true); });
+	QObject::connect(this, &QTreeView::collapsed, this, [this](const QModelIndex &index) { this->SetFolderExpanded(index, false); });
+
+	this->_activation_timer.setSingleShot(true);
+	QObject::connect(&this->_activation_timer, &QTimer::timeout, this, &StvItemView::ActivatePendingScene);
+}
 
 void StvItemView::SetItemModel(StvItemModel *model)
 {
 	this->_model = model;
 }
 
+void StvItemView::reset()
+{
+	this->QTreeView::reset();
+	if(!this->_model)
+		return;
+
+	// The view lays out its items lazily after a reset, so expanding folders here only records their state
+	for(int row = 0; row < this->_model->rowCount(); ++row)
+	{
+		this->RestoreFolderExpansion(this->_model->index(row, 0));
+	}
+}
+
+void StvItemView::SelectSceneItem(const QModelIndex &index)
+{
+	// OBS switched scenes, a scene selected before doesn't replace it anymore
+	this->CancelPendingScene();
+
+	this->_is_selecting_scene_item = true;
+	this->setCurrentIndex(index);
+	this->_is_selecting_scene_item = false;
+}
+
 void StvItemView::selectionChanged(const QItemSelection &selected, const QItemSelection &deselected)
 {
 	this->QTreeView::selectionChanged(selected, deselected);
 
-	if(selected.indexes().size() == 0)
+	// The scene is already active if the selection follows a scene change
+	if(selected.indexes().size() == 0 || this->_is_selecting_scene_item)
+		return;
+
+	// Only switch scenes for single selections, multiple selected items are being organized
+	const QModelIndexList selection = this->selectionModel()->selectedIndexes();
+	if(selection.size() != 1)
 		return;
 
-	assert(selected.indexes().size() == 1);
-	QStandardItem *item = this->_model->itemFromIndex(selected.indexes().front());
-	if(item->type() == StvItemModel::SCENE)
-		this->_model->SetSelectedScene(item, obs_frontend_preview_program_mode_active());
+	// Scenes passed while navigating with the keyboard are only highlighted
+	if(this->_deferred_activation && this->_is_navigating)
+	{
+		this->_pending_scene_index = selection.front();
+		this->_activation_timer.start();
+	}
+	else
+		this->ActivateSceneItem(selection.front());
+}
+
+void StvItemView::SetDeferredActivation(bool enabled, int delay_ms)
+{
+	this->_deferred_activation = enabled;
+	this->_activation_timer.setInterval(std::max(delay_ms, 0));
+
+	if(!enabled)
+		this->CancelPendingScene();
+}
+
+void StvItemView::keyPressEvent(QKeyEvent *event)
+{
+	// Enter switches to the highlighted scene right away, unless an item is being renamed
+	if(this->_deferred_activation && this->state() != QAbstractItemView::EditingState &&
+	        (event->key() == Qt::Key_Return || event->key() == Qt::Key_Enter))
+	{
+		this->CancelPendingScene();
+		this->ActivateSceneItem(this->currentIndex());
+
+		event->accept();
+		return;
+	}
+
+	this->_is_navigating = true;
+	this->QTreeView::keyPressEvent(event);
+	this->_is_navigating = false;
+}
+
+void StvItemView::ActivateSceneItem(const QModelIndex &index)
+{
+	// Selections made otherwise replace a scene that is still pending
+	this->CancelPendingScene();
+
+	if(this->_model->IsScene(index))
+		this->_model->SetSelectedScene(index, obs_frontend_preview_program_mode_active());
+}
+
+void StvItemView::ActivatePendingScene()
+{
+	if(!this->_pending_scene_index.isValid())
+		return;
+
+	// Only switch if the pending scene is still the selected one
+	const QModelIndex index = this->_pending_scene_index;
+	const QModelIndexList selection = this->selectionModel()->selectedIndexes();
+	if(selection.size() == 1 && selection.front() == index)
+		this->ActivateSceneItem(index);
+	else
+		this->CancelPendingScene();
+}
+
+void StvItemView::CancelPendingScene()
+{
+	this->_activation_timer.stop();
+	this->_pending_scene_index = QPersistentModelIndex();
+}
+
+void StvItemView::rowsInserted(const QModelIndex &parent, int start, int end)
+{
+	this->QTreeView::rowsInserted(parent, start, end);
+
+	// Moved folders are reinserted, expand them again. Their child folders follow once they're shown
+	for(int row = start; row <= end; ++row)
+	{
+		this->RestoreFolderExpansion(this->_model->index(row, 0, parent));
+	}
 }
 
 void StvItemView::EditSelectedItem()
@@ -41,10 +151,10 @@ void StvItemView::mouseDoubleClickEvent(QMouseEvent *event)
 
 		if(transition_enabled)
 		{
-			QStandardItem *item = this->_model->itemFromIndex(this->indexAt(event->pos()));
-			if(item && item->type() == StvItemModel::SCENE)
+			const QModelIndex index = this->indexAt(event->pos());
+			if(this->_model->IsScene(index))
 			{
-				this->_model->SetSelectedScene(item, false, true);
+				this->_model->SetSelectedScene(index, false, true);
 				return;
 			}
 		}
@@ -53,3 +163,44 @@ void StvItemView::mouseDoubleClickEvent(QMouseEvent *event)
 	// If TransitionOnDoubleClick is disabled or a folder is selected, perform a normal edit on double click
 	return QTreeView::mouseDoubleClickEvent(event);
 }
+
+void StvItemView::SetFolderExpanded(const QModelIndex &index, bool expanded)
+{
+	this->_model->SetFolderExpanded(index, expanded);
+
+	// Child folders are only expanded once their folder is shown, so that only shown folders are visited
+	if(expanded && this->IsShown(index))
+		this->RestoreChildExpansion(index);
+}
+
+void StvItemView::RestoreFolderExpansion(const QModelIndex &index)
+{
+	if(!this->_model->IsFolderExpanded(index))
+		return;
+
+	// Child folders are restored by SetFolderExpanded(). A folder that was expanded while it was hidden
+	// restores its child folders now
+	if(!this->isExpanded(index))
+		this->setExpanded(index, true);
+	else
+		this->RestoreChildExpansion(index);
+}
+
+void StvItemView::RestoreChildExpansion(const QModelIndex &index)
+{
+	for(int row = 0; row < this->_model->rowCount(index); ++row)
+	{
+		this->RestoreFolderExpansion(this->_model->index(row, 0, index));
+	}
+}
+
+bool StvItemView::IsShown(const QModelIndex &index) const
+{
+	for(QModelIndex parent = index.parent(); parent.isValid(); parent = parent.parent())
+	{
+		if(!this->isExpanded(parent))
+			return false;
+	}
+
+	return true;
+}
@@ -1,6 +1,7 @@
 #ifndef STV_ITEM_VIEW_H
 #define STV_ITEM_VIEW_H
 
+#include <QTimer>
 #include <QtWidgets/QTreeView>
 
 #include "obs_scene_tree_view/stv_item_model.h"
@@ -16,16 +17,43 @@ class StvItemView
 
 		void SetItemModel(StvItemModel *model);
 
+		// Expands the folders that are marked as expanded in the model
+		void reset() override;
+
+		// Selects the item of the scene OBS switched to, without switching scenes again
+		void SelectSceneItem(const QModelIndex &index);
+
+		// If enabled, selecting a scene with the keyboard only switches to it once the selection didn't change for
+		// the given delay, or when Enter is pressed
+		void SetDeferredActivation(bool enabled, int delay_ms);
+
 	protected slots:
 		void selectionChanged(const QItemSelection &selected, const QItemSelection &deselected) override;
+		void rowsInserted(const QModelIndex &parent, int start, int end) override;
 		//bool edit(const QModelIndex &index, EditTrigger trigger, QEvent *event) override;
 
 		void EditSelectedItem();
 
 		void mouseDoubleClickEvent(QMouseEvent *event) override;
+		void keyPressEvent(QKeyEvent *event) override;
 
 	private:
 		StvItemModel *_model = nullptr;
+		bool _is_selecting_scene_item = false;
+
+		bool _deferred_activation = false;
+		bool _is_navigating = false;
+		QTimer _activation_timer;
+		QPersistentModelIndex _pending_scene_index;
+
+		void ActivateSceneItem(const QModelIndex &index);
+		void ActivatePendingScene();
+		void CancelPendingScene();
+
+		void SetFolderExpanded(const QModelIndex &index, bool expanded);
+		void RestoreFolderExpansion(const QModelIndex &index);
+		void RestoreChildExpansion(const QModelIndex &index);
+		bool IsShown(const QModelIndex &index) const;
 };
 
 #endif //STV_ITEM_VIEW_H
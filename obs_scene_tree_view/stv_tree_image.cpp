@@ -0,0 +1,175 @@
+#include "obs_scene_tree_view/stv_tree_image.h"
+
+#include "obs_scene_tree_view/stv_item_model.h"
+
+#include <obs-module.h>
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+
+bool StvTreeImage::Open(const std::string &path)
+{
+	this->_file.setFileName(QString::fromStdString(path));
+	if(!this->_file.open(QIODevice::ReadOnly))
+		return false;
+
+	const qint64 file_size = this->_file.size();
+	const uchar *data = file_size >= (qint64)sizeof(header_t) ? this->_file.map(0, file_size) : nullptr;
+	if(!data)
+	{
+		blog(LOG_WARNING, "[%s] Failed to map scene tree '%s'", obs_module_name(), path.c_str());
+		return false;
+	}
+
+	this->_header = reinterpret_cast<const header_t*>(data);
+
+	const uint64_t required_size = sizeof(header_t) + (uint64_t)this->_header->NodeCount * sizeof(node_t) +
+	                               this->_header->StringTableSize;
+	const bool is_valid_header = std::memcmp(this->_header->Magic, MAGIC.data(), sizeof(this->_header->Magic)) == 0 &&
+	                             this->_header->Version == VERSION && this->_header->ByteOrder == BYTE_ORDER_MARK &&
+	                             (uint64_t)file_size >= required_size;
+	if(is_valid_header)
+	{
+		this->_nodes = reinterpret_cast<const node_t*>(data + sizeof(header_t));
+		this->_strings = reinterpret_cast<const char*>(this->_nodes + this->_header->NodeCount);
+	}
+
+	if(!is_valid_header || !this->IsValidTree())
+	{
+		blog(LOG_WARNING, "[%s] Scene tree '%s' is invalid, of an unsupported version or of another byte order", obs_module_name(), path.c_str());
+
+		this->_file.close();
+		this->_header = nullptr;
+		return false;
+	}
+
+	return true;
+}
+
+obs_data_array_t *StvTreeImage::CreateFolderArray(uint32_t first, uint32_t end) const
+{
+	return CreateFolderArray(this->_nodes, this->_strings, first, end);
+}
+
+obs_data_array_t *StvTreeImage::CreateFolderArray(const node_t *nodes, const char *strings, uint32_t first, uint32_t end)
+{
+	obs_data_array_t *folder_data = obs_data_array_create();
+
+	for(uint32_t i = first; i < end; i = nodes[i].SubtreeEnd)
+	{
+		const node_t &node = nodes[i];
+
+		OBSDataAutoRelease item_data = obs_data_create();
+		if(node.Flags & FOLDER_FLAG)
+		{
+			OBSDataArrayAutoRelease sub_folder_data = CreateFolderArray(nodes, strings, i + 1, node.SubtreeEnd);
+			obs_data_set_array(item_data, StvItemModel::SCENE_TREE_CONFIG_FOLDER_DATA.data(), sub_folder_data);
+			obs_data_set_bool(item_data, StvItemModel::SCENE_TREE_CONFIG_FOLDER_EXPANDED.data(), node.Flags & EXPANDED_FLAG);
+		}
+		else if(node.UuidSize > 0)
+		{
+			obs_data_set_string(item_data, StvItemModel::SCENE_TREE_CONFIG_SCENE_UUID_DATA.data(),
+			                    std::string(strings + node.UuidOffset, node.UuidSize).c_str());
+		}
+
+		obs_data_set_string(item_data, StvItemModel::SCENE_TREE_CONFIG_ITEM_NAME_DATA.data(), std::string(strings + node.NameOffset, node.NameSize).c_str());
+		obs_data_set_int(item_data, StvItemModel::SCENE_TREE_CONFIG_NODE_ID_DATA.data(), (long long)node.NodeId);
+		obs_data_array_push_back(folder_data, item_data);
+	}
+
+	return folder_data;
+}
+
+bool StvTreeImage::IsValidTree() const
+{
+	// Ends of the folders that contain the current node, from the outermost folder to the innermost one
+	std::vector<uint32_t> folder_ends;
+
+	const uint32_t node_count = this->_header->NodeCount;
+	for(uint32_t i = 0; i < node_count; ++i)
+	{
+		while(!folder_ends.empty() && folder_ends.back() == i)
+			folder_ends.pop_back();
+
+		const uint32_t end = folder_ends.empty() ? node_count : folder_ends.back();
+		const node_t &node = this->_nodes[i];
+		if(node.SubtreeEnd <= i || node.SubtreeEnd > end || (uint64_t)node.NameOffset + node.NameSize > this->_header->StringTableSize ||
+		        (uint64_t)node.UuidOffset + node.UuidSize > this->_header->StringTableSize)
+			return false;
+
+		// Only folders have a subtree
+		if(!(node.Flags & FOLDER_FLAG))
+		{
+			if(node.SubtreeEnd != i + 1)
+				return false;
+		}
+		else if(node.SubtreeEnd > i + 1)
+		{
+			if(folder_ends.size() >= MAX_FOLDER_DEPTH)
+				return false;
+
+			folder_ends.push_back(node.SubtreeEnd);
+		}
+	}
+
+	return true;
+}
+
+void StvTreeSnapshot::AddScene(std::string_view name, std::string_view uuid, uint64_t node_id)
+{
+	this->AddNode(name, uuid, node_id, 0);
+}
+
+void StvTreeSnapshot::BeginFolder(std::string_view name, uint64_t node_id, bool is_expanded)
+{
+	this->_open_folders.push_back((uint32_t)this->_nodes.size());
+	this->AddNode(name, std::string_view(), node_id, StvTreeImage::FOLDER_FLAG | (is_expanded ? StvTreeImage::EXPANDED_FLAG : 0));
+}
+
+void StvTreeSnapshot::EndFolder()
+{
+	assert(!this->_open_folders.empty());
+
+	this->_nodes[this->_open_folders.back()].SubtreeEnd = (uint32_t)this->_nodes.size();
+	this->_open_folders.pop_back();
+}
+
+QByteArray StvTreeSnapshot::CreateImage(int64_t generation) const
+{
+	assert(this->_open_folders.empty());
+
+	StvTreeImage::header_t header = {};
+	std::memcpy(header.Magic, StvTreeImage::MAGIC.data(), sizeof(header.Magic));
+	header.Version = StvTreeImage::VERSION;
+	header.ByteOrder = StvTreeImage::BYTE_ORDER_MARK;
+	header.Generation = generation;
+	header.NodeCount = (uint32_t)this->_nodes.size();
+	header.StringTableSize = (uint32_t)this->_strings.size();
+
+	QByteArray image;
+	image.reserve(sizeof(header) + this->_nodes.size() * sizeof(StvTreeImage::node_t) + this->_strings.size());
+	image.append(reinterpret_cast<const char*>(&header), sizeof(header));
+	image.append(reinterpret_cast<const char*>(this->_nodes.data()), this->_nodes.size() * sizeof(StvTreeImage::node_t));
+	image.append(this->_strings.data(), this->_strings.size());
+
+	return image;
+}
+
+obs_data_array_t *StvTreeSnapshot::CreateFolderArray() const
+{
+	assert(this->_open_folders.empty());
+
+	return StvTreeImage::CreateFolderArray(this->_nodes.data(), this->_strings.data(), 0, (uint32_t)this->_nodes.size());
+}
+
+void StvTreeSnapshot::AddNode(std::string_view name, std::string_view uuid, uint64_t node_id, uint32_t flags)
+{
+	// Scenes end right after themselves, EndFolder() sets the end of folders
+	const uint32_t name_offset = (uint32_t)this->_strings.size();
+	this->_nodes.push_back(StvTreeImage::node_t{node_id, name_offset, (uint32_t)name.size(), name_offset + (uint32_t)name.size(),
+	                                            (uint32_t)uuid.size(), (uint32_t)this->_nodes.size() + 1, flags});
+	this->_strings.append(name);
+	this->_strings.append(uuid);
+}
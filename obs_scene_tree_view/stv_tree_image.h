@@ -0,0 +1,110 @@
+#ifndef STV_TREE_IMAGE_H
+#define STV_TREE_IMAGE_H
+
+#include <obs.hpp>
+
+#include <QByteArray>
+#include <QFile>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Binary tree file that is mapped into memory and read in place. Nodes are stored in pre-order in a flat table,
+// each node stores the index after its subtree. Names and scene UUIDs are stored in a separate string table.
+// All values use the byte order of the machine that wrote the file, images of another byte order are rejected
+class StvTreeImage
+{
+	public:
+		static constexpr std::string_view FILE_EXTENSION = ".stvb";
+		static constexpr std::string_view MAGIC = "STVB";
+		static constexpr uint32_t VERSION = 3;
+
+		// Reads as a different value if the image was written with another byte order
+		static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+		// Folders are read recursively, images with more nested folders are rejected
+		static constexpr uint32_t MAX_FOLDER_DEPTH = 1024;
+
+		static constexpr uint32_t FOLDER_FLAG = 1 << 0;
+		static constexpr uint32_t EXPANDED_FLAG = 1 << 1;
+
+		struct header_t
+		{
+			char Magic[4];
+			uint32_t Version;
+			uint32_t ByteOrder;
+			uint32_t NodeCount;
+			int64_t Generation;
+			uint32_t StringTableSize;
+			uint32_t Reserved;
+		};
+
+		struct node_t
+		{
+			uint64_t NodeId;
+			uint32_t NameOffset;
+			uint32_t NameSize;
+			uint32_t UuidOffset;
+			uint32_t UuidSize;
+			uint32_t SubtreeEnd;
+			uint32_t Flags;
+		};
+
+		static_assert(sizeof(header_t) == 32 && sizeof(node_t) == 32, "Tree image layout changed");
+
+		// Maps the file and checks that all offsets are in range
+		bool Open(const std::string &path);
+
+		int64_t Generation() const
+		{	return this->_header->Generation;	}
+
+		uint32_t NodeCount() const
+		{	return this->_header->NodeCount;	}
+
+		const node_t &Node(uint32_t index) const
+		{	return this->_nodes[index];	}
+
+		std::string_view NodeName(const node_t &node) const
+		{	return std::string_view(this->_strings + node.NameOffset, node.NameSize);	}
+
+		// Empty for folders
+		std::string_view NodeUuid(const node_t &node) const
+		{	return std::string_view(this->_strings + node.UuidOffset, node.UuidSize);	}
+
+		// Same layout as the folder arrays of the JSON tree files
+		obs_data_array_t *CreateFolderArray(uint32_t first, uint32_t end) const;
+		static obs_data_array_t *CreateFolderArray(const node_t *nodes, const char *strings, uint32_t first, uint32_t end);
+
+	private:
+		QFile _file;
+		const header_t *_header = nullptr;
+		const node_t *_nodes = nullptr;
+		const char *_strings = nullptr;
+
+		bool IsValidTree() const;
+};
+
+// Copy of a tree in the node layout of tree images, so that it can be written without accessing the model.
+// Items are added in pre-order, the items of a folder between BeginFolder() and EndFolder()
+class StvTreeSnapshot
+{
+	public:
+		void AddScene(std::string_view name, std::string_view uuid, uint64_t node_id);
+		void BeginFolder(std::string_view name, uint64_t node_id, bool is_expanded);
+		void EndFolder();
+
+		QByteArray CreateImage(int64_t generation) const;
+		obs_data_array_t *CreateFolderArray() const;
+
+	private:
+		std::vector<StvTreeImage::node_t> _nodes;
+		std::string _strings;
+		std::vector<uint32_t> _open_folders;
+
+		void AddNode(std::string_view name, std::string_view uuid, uint64_t node_id, uint32_t flags);
+};
+
+#endif //STV_TREE_IMAGE_H
@@ -0,0 +1,1037 @@
+#include "obs_scene_tree_view/stv_tree_storage.h"
+
+#include "obs_scene_tree_view/stv_item_model.h"
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/util.hpp>
+
+#include <QSaveFile>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+
+static size_t FindItemRow(obs_data_array_t *folder_data, obs_data_t *item_data)
+{
+	const size_t item_count = obs_data_array_count(folder_data);
+	for(size_t i = 0; i < item_count; ++i)
+	{
+		OBSDataAutoRelease row_data = obs_data_array_item(folder_data, i);
+		if(row_data.Get() == item_data)
+			return i;
+	}
+
+	return item_count;
+}
+
+static bool EraseItem(obs_data_array_t *folder_data, obs_data_t *item_data)
+{
+	const size_t row = FindItemRow(folder_data, item_data);
+	if(row >= obs_data_array_count(folder_data))
+		return false;
+
+	obs_data_array_erase(folder_data, row);
+	return true;
+}
+
+static void RemoveFile(const std::string &path)
+{
+	if(os_file_exists(path.c_str()))
+		os_unlink(path.c_str());
+}
+
+static bool SyncFile(FILE *file)
+{
+	// Flushed data only reaches the OS cache, it survives process crashes but not a power loss
+	if(fflush(file) != 0)
+		return false;
+
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+static void InsertItem(obs_data_array_t *folder_data, long long row, obs_data_t *item_data)
+{
+	const size_t item_count = obs_data_array_count(folder_data);
+	obs_data_array_insert(folder_data, std::min<size_t>((size_t)std::max<long long>(row, 0), item_count), item_data);
+}
+
+
+void StvTreeStorage::Open()
+{
+	BPtr<char> tree_dir = obs_module_config_path(TREE_DIR.data());
+	if(!this->Open(tree_dir))
+		this->MigrateLegacyFile();
+}
+
+bool StvTreeStorage::Open(const char *tree_dir)
+{
+	this->_tree_dir = tree_dir;
+
+	if(os_mkdirs(tree_dir) == MKDIR_ERROR)
+		blog(LOG_WARNING, "[%s] Failed to create scene tree dir '%s'", obs_module_name(), tree_dir);
+
+	return this->ReadManifest();
+}
+
+bool StvTreeStorage::RenameCollection(const char *old_name, const char *new_name)
+{
+	if(!old_name || !new_name || strcmp(old_name, new_name) == 0)
+		return false;
+
+	// Pending writes still record their trees under the old name
+	this->WaitForWrites();
+
+	const auto file_it = this->_collection_files.find(old_name);
+	if(file_it == this->_collection_files.end())
+		return false;
+
+	std::string file_name = std::move(file_it->second);
+	this->_collection_files.erase(file_it);
+
+	// The renamed collection replaces the tree left behind by a previous collection of the same name
+	std::string replaced_file_name;
+	if(const auto replaced_it = this->_collection_files.find(new_name); replaced_it != this->_collection_files.end())
+	{
+		replaced_file_name = std::move(replaced_it->second);
+		replaced_it->second = std::move(file_name);
+	}
+	else
+		this->_collection_files.emplace(new_name, std::move(file_name));
+
+	// The journal belongs to the file, the resident tree is saved under the collection name
+	if(const auto journal_it = this->_journals.find(old_name); journal_it != this->_journals.end())
+	{
+		this->_journals[new_name] = journal_it->second;
+		this->_journals.erase(old_name);
+	}
+	else
+		this->_journals.erase(new_name);
+
+	this->_resident_trees.erase(old_name);
+	this->_resident_trees.erase(new_name);
+
+	// The renamed collection exists
+	this->_missing_collections.erase(old_name);
+	this->_missing_collections.erase(new_name);
+	this->_previously_missing_collections.erase(old_name);
+	this->_previously_missing_collections.erase(new_name);
+
+	if(!this->WriteManifest())
+		return false;
+
+	// Files are only removed once the manifest no longer refers to them
+	if(!replaced_file_name.empty())
+		this->RemoveTreeFiles(replaced_file_name);
+
+	return true;
+}
+
+void StvTreeStorage::CollectGarbage(const std::unordered_set<std::string> &scene_collections)
+{
+	// Files are only removed once nothing is written to them anymore
+	this->WaitForWrites();
+
+	bool is_manifest_changed = false;
+	std::vector<std::string> removed_file_names;
+	for(auto file_it = this->_collection_files.begin(); file_it != this->_collection_files.end();)
+	{
+		const std::string &scene_collection = file_it->first;
+		if(scene_collections.count(scene_collection))
+		{
+			// The collection was only missing temporarily
+			this->_previously_missing_collections.erase(scene_collection);
+			is_manifest_changed |= this->_missing_collections.erase(scene_collection) > 0;
+
+			++file_it;
+			continue;
+		}
+
+		// Trees of collections that went missing during this session are only marked, OBS may list them again
+		if(!this->_previously_missing_collections.count(scene_collection))
+		{
+			is_manifest_changed |= this->_missing_collections.insert(scene_collection).second;
+
+			++file_it;
+			continue;
+		}
+
+		this->_journals.erase(scene_collection);
+		this->_resident_trees.erase(scene_collection);
+		this->_missing_collections.erase(scene_collection);
+		this->_previously_missing_collections.erase(scene_collection);
+		removed_file_names.push_back(std::move(file_it->second));
+		file_it = this->_collection_files.erase(file_it);
+	}
+
+	// Files are only removed once the manifest no longer refers to them
+	if((is_manifest_changed || !removed_file_names.empty()) && !this->WriteManifest())
+		removed_file_names.clear();
+
+	this->_used_files.clear();
+	this->_used_files.insert(MANIFEST_FILE.data());
+	for(const auto &collection_file : this->_collection_files)
+		this->_used_files.insert(collection_file.second);
+
+	// Only files of collections removed by this pass are deleted, including their backups and journals. Files that
+	// aren't listed in the manifest are kept, the manifest may have been lost and recreated
+	os_dir_t *tree_dir = os_opendir(this->_tree_dir.c_str());
+	if(!tree_dir)
+		return;
+
+	size_t kept_files = 0, removed_files = 0;
+	int64_t kept_size = 0, removed_size = 0;
+	for(struct os_dirent *entry = os_readdir(tree_dir); entry; entry = os_readdir(tree_dir))
+	{
+		if(entry->directory)
+			continue;
+
+		const std::string path_name = entry->d_name;
+		const auto is_file_of = [&path_name](const std::string &file_name) {
+			return IsCollectionFile(path_name, file_name);
+		};
+
+		const bool is_used = std::any_of(this->_used_files.begin(), this->_used_files.end(), is_file_of) ||
+		                     std::none_of(removed_file_names.begin(), removed_file_names.end(), is_file_of);
+
+		file_stat_t file_stat;
+		const std::string path = this->GetTreePath(path_name);
+		GetFileStat(path, file_stat);
+
+		if(is_used)
+		{
+			++kept_files;
+			kept_size += std::max<int64_t>(file_stat.Size, 0);
+		}
+		else if(os_unlink(path.c_str()) == 0)
+		{
+			++removed_files;
+			removed_size += std::max<int64_t>(file_stat.Size, 0);
+		}
+	}
+
+	os_closedir(tree_dir);
+
+	blog(LOG_INFO, "[%s] Scene tree storage holds %zu collections in %zu files (%lld bytes), %zu of them missing since this start. "
+	     "Removed %zu orphaned collections in %zu files (%lld bytes)", obs_module_name(), this->_collection_files.size(), kept_files,
+	     (long long)kept_size, this->_missing_collections.size(), removed_file_names.size(), removed_files, (long long)removed_size);
+}
+
+void StvTreeStorage::PreloadTree(const char *scene_collection)
+{
+	if(!scene_collection)
+		return;
+
+	const auto file_it = this->_collection_files.find(scene_collection);
+	if(file_it == this->_collection_files.end() || this->UsesImage(file_it->second))
+		return;
+
+	// A save of the same tree replaces the job if it didn't start yet
+	this->_writer.Submit(file_it->second, [this, collection = std::string(scene_collection), tree_path = this->GetTreePath(file_it->second)]() {
+		// The file is read after its stats, a change in between is detected when the tree is loaded
+		file_stat_t file_stat;
+		if(!GetFileStat(tree_path, file_stat))
+			return;
+
+		OBSDataAutoRelease tree_data = obs_data_create_from_json_file_safe(tree_path.c_str(), "bak");
+		if(!tree_data)
+			return;
+
+		std::lock_guard<std::mutex> lock(this->_written_mutex);
+		this->_preloaded_trees[collection] = resident_tree_t{OBSData(tree_data.Get()), file_stat};
+	});
+}
+
+obs_data_t *StvTreeStorage::LoadTree(const char *scene_collection)
+{
+	if(!scene_collection)
+		return nullptr;
+
+	// Trees that are still being written have to be read from their new files
+	this->WaitForWrites();
+
+	const auto file_it = this->_collection_files.find(scene_collection);
+	if(file_it == this->_collection_files.end())
+		return nullptr;
+
+	const bool uses_image = this->UsesImage(file_it->second);
+	const std::string tree_path = uses_image ? this->GetImagePath(file_it->second) : this->GetTreePath(file_it->second);
+
+	// Trees are only parsed again if their file changed since it was last read or written
+	const auto resident_it = this->_resident_trees.find(scene_collection);
+	if(resident_it != this->_resident_trees.end())
+	{
+		file_stat_t file_stat;
+		if(GetFileStat(tree_path, file_stat) && file_stat == resident_it->second.FileStat)
+		{
+			obs_data_addref(resident_it->second.Data);
+			return resident_it->second.Data;
+		}
+
+		this->_resident_trees.erase(resident_it);
+	}
+
+	obs_data_t *tree_data = uses_image ? this->CreateTreeData(scene_collection, tree_path) : this->TakePreloadedTree(scene_collection, tree_path);
+	if(!tree_data && !uses_image)
+		tree_data = obs_data_create_from_json_file_safe(tree_path.c_str(), "bak");
+	if(!tree_data)
+		return nullptr;
+
+	// Apply the edits made after the tree file was written
+	journal_t &journal = this->_journals[scene_collection];
+	journal = journal_t{obs_data_get_int(tree_data, JOURNAL_GENERATION.data())};
+
+	OBSDataArrayAutoRelease root_folder_data = obs_data_get_array(tree_data, scene_collection);
+	if(root_folder_data)
+		this->ReplayJournals(this->GetTreePath(file_it->second), root_folder_data, journal);
+
+	this->SetResidentTree(scene_collection, tree_data, tree_path);
+
+	return tree_data;
+}
+
+bool StvTreeStorage::SaveTree(const char *scene_collection, StvTreeSnapshot &&snapshot)
+{
+	if(!scene_collection)
+		return false;
+
+	// The manifest only changes when a collection is saved for the first time
+	const bool is_new_collection = this->_collection_files.find(scene_collection) == this->_collection_files.end();
+	const std::string &file_name = this->GetCollectionFile(scene_collection);
+
+	// Edits made from now on are journaled for the tree that is about to be written. Previous journals are only
+	// removed once the tree was written
+	journal_t &journal = this->_journals[scene_collection];
+	this->StartJournal(file_name, journal);
+
+	this->_resident_trees.erase(scene_collection);
+
+	const auto tree_write = std::make_shared<tree_write_t>(tree_write_t{scene_collection, this->GetTreePath(file_name),
+	                                                                    this->GetImagePath(file_name), journal.Generation,
+	                                                                    this->_binary_format, std::move(snapshot)});
+	this->_writer.Submit(file_name, [this, tree_write]() {
+		this->WriteTree(*tree_write);
+	});
+
+	return !is_new_collection || this->WriteManifest();
+}
+
+void StvTreeStorage::WaitForWrites()
+{
+	this->_writer.Wait();
+
+	// Written trees become resident, unless edits were journaled since they were captured
+	std::lock_guard<std::mutex> lock(this->_written_mutex);
+	for(const auto &written_tree : this->_written_trees)
+	{
+		const auto journal_it = this->_journals.find(written_tree.first);
+		const auto file_it = this->_collection_files.find(written_tree.first);
+		if(journal_it == this->_journals.end() || journal_it->second.Generation != written_tree.second.Generation ||
+		        journal_it->second.HasEdits || file_it == this->_collection_files.end())
+			continue;
+
+		this->SetResidentTree(written_tree.first.c_str(), written_tree.second.Data, this->GetTreePath(file_it->second));
+	}
+
+	this->_written_trees.clear();
+}
+
+void StvTreeStorage::SetBinaryFormat(bool enabled)
+{
+	this->_binary_format = enabled;
+}
+
+bool StvTreeStorage::LoadTreeImage(const char *scene_collection, StvTreeImage &tree_image)
+{
+	if(!scene_collection)
+		return false;
+
+	this->WaitForWrites();
+
+	const auto file_it = this->_collection_files.find(scene_collection);
+	if(file_it == this->_collection_files.end() || !this->UsesImage(file_it->second))
+		return false;
+
+	if(!tree_image.Open(this->GetImagePath(file_it->second)))
+		return false;
+
+	// Journaled edits are applied to the JSON representation
+	journal_t journal{tree_image.Generation()};
+	if(!this->IsJournalEmpty(this->GetTreePath(file_it->second), journal))
+		return false;
+
+	this->_journals[scene_collection] = journal;
+	return true;
+}
+
+void StvTreeStorage::SetJournalEnabled(bool enabled)
+{
+	this->_journal_enabled = enabled;
+}
+
+bool StvTreeStorage::ContinueJournal(const char *scene_collection)
+{
+	if(!scene_collection || !this->_journal_enabled)
+		return false;
+
+	const auto journal_it = this->_journals.find(scene_collection);
+	const auto file_it = this->_collection_files.find(scene_collection);
+	if(journal_it == this->_journals.end() || file_it == this->_collection_files.end())
+		return false;
+
+	journal_t &journal = journal_it->second;
+	if(journal.IsOpen)
+		return true;
+
+	// Replayed edits of a journal that can't be continued, or journals of later generations, are only kept
+	// by a full save
+	const std::string tree_path = this->GetTreePath(file_it->second);
+	if(journal.HasEdits || os_file_exists(GetJournalPath(tree_path, journal.Generation + 1).c_str()))
+		return false;
+
+	return this->ResetJournal(GetJournalPath(tree_path, journal.Generation), journal);
+}
+
+bool StvTreeStorage::AppendJournal(const char *scene_collection, obs_data_t *operation)
+{
+	if(!scene_collection || !this->_journal_enabled)
+		return false;
+
+	const auto journal_it = this->_journals.find(scene_collection);
+	if(journal_it == this->_journals.end() || !journal_it->second.IsOpen)
+		return false;
+
+	journal_t &journal = journal_it->second;
+	const std::string journal_path = GetJournalPath(this->GetTreePath(this->_collection_files.at(scene_collection)), journal.Generation);
+
+	std::string line = obs_data_get_json(operation);
+	line += '\n';
+
+	// Each edit is written at once and synced to disk. A line that was cut off is dropped when the journal is replayed
+	FILE *journal_file = os_fopen(journal_path.c_str(), "ab");
+	const bool written = journal_file && fwrite(line.data(), 1, line.size(), journal_file) == line.size() && SyncFile(journal_file);
+	if(journal_file)
+		fclose(journal_file);
+
+	if(!written)
+	{
+		blog(LOG_WARNING, "[%s] Failed to append to scene tree journal '%s'", obs_module_name(), journal_path.c_str());
+
+		// Further edits would follow a broken line, wait for the next full save
+		journal.IsOpen = false;
+		return false;
+	}
+
+	journal.Size += line.size();
+	journal.HasEdits = true;
+
+	// The resident tree no longer contains all edits
+	this->_resident_trees.erase(scene_collection);
+	return true;
+}
+
+bool StvTreeStorage::NeedsCompaction(const char *scene_collection) const
+{
+	if(!scene_collection)
+		return false;
+
+	const auto journal_it = this->_journals.find(scene_collection);
+	return journal_it != this->_journals.end() && journal_it->second.Size > JOURNAL_COMPACTION_SIZE;
+}
+
+std::string StvTreeStorage::GetTreePath(const std::string &file_name) const
+{
+	return this->_tree_dir + "/" + file_name;
+}
+
+std::string StvTreeStorage::GetJournalPath(const std::string &tree_path, long long generation)
+{
+	return tree_path + "." + std::to_string(generation) + JOURNAL_EXTENSION.data();
+}
+
+std::string StvTreeStorage::GetImagePath(const std::string &file_name) const
+{
+	return this->GetTreePath(file_name) + StvTreeImage::FILE_EXTENSION.data();
+}
+
+bool StvTreeStorage::UsesImage(const std::string &file_name) const
+{
+	// Both files only exist if removing the previous one failed after saving. The configured format was saved last then
+	if(!os_file_exists(this->GetImagePath(file_name).c_str()))
+		return false;
+
+	return this->_binary_format || !os_file_exists(this->GetTreePath(file_name).c_str());
+}
+
+obs_data_t *StvTreeStorage::CreateTreeData(const char *scene_collection, const std::string &image_path) const
+{
+	StvTreeImage tree_image;
+	if(!tree_image.Open(image_path))
+		return nullptr;
+
+	OBSDataArrayAutoRelease root_folder_data = tree_image.CreateFolderArray(0, tree_image.NodeCount());
+
+	obs_data_t *tree_data = obs_data_create();
+	obs_data_set_array(tree_data, scene_collection, root_folder_data);
+	obs_data_set_int(tree_data, JOURNAL_GENERATION.data(), tree_image.Generation());
+
+	return tree_data;
+}
+
+bool StvTreeStorage::GetFileStat(const std::string &path, file_stat_t &file_stat)
+{
+	// The modification time is read with the resolution of the file system instead of seconds, so that a file
+	// rewritten within the same second with the same size is detected as changed
+	std::error_code error;
+	const std::filesystem::path file_path = std::filesystem::u8path(path);
+
+	const std::uintmax_t size = std::filesystem::file_size(file_path, error);
+	if(error)
+		return false;
+
+	const std::filesystem::file_time_type modified_time = std::filesystem::last_write_time(file_path, error);
+	if(error)
+		return false;
+
+	file_stat.Size = (int64_t)size;
+	file_stat.ModifiedTime = (int64_t)modified_time.time_since_epoch().count();
+	return true;
+}
+
+void StvTreeStorage::SetResidentTree(const char *scene_collection, obs_data_t *tree_data, const std::string &tree_path)
+{
+	// Keep the tree only if later changes to its file can be detected
+	file_stat_t file_stat;
+	if(GetFileStat(tree_path, file_stat))
+		this->_resident_trees[scene_collection] = resident_tree_t{OBSData(tree_data), file_stat};
+	else
+		this->_resident_trees.erase(scene_collection);
+}
+
+obs_data_t *StvTreeStorage::TakePreloadedTree(const char *scene_collection, const std::string &tree_path)
+{
+	std::lock_guard<std::mutex> lock(this->_written_mutex);
+
+	const auto preloaded_it = this->_preloaded_trees.find(scene_collection);
+	if(preloaded_it == this->_preloaded_trees.end())
+		return nullptr;
+
+	// Preloaded trees are only used once, and only if their file didn't change since
+	const resident_tree_t preloaded_tree = std::move(preloaded_it->second);
+	this->_preloaded_trees.erase(preloaded_it);
+
+	file_stat_t file_stat;
+	if(!GetFileStat(tree_path, file_stat) || !(file_stat == preloaded_tree.FileStat))
+		return nullptr;
+
+	obs_data_addref(preloaded_tree.Data);
+	return preloaded_tree.Data;
+}
+
+const std::string &StvTreeStorage::GetCollectionFile(const char *scene_collection)
+{
+	auto file_it = this->_collection_files.find(scene_collection);
+	if(file_it == this->_collection_files.end())
+	{
+		std::string file_name = this->CreateFileName(scene_collection);
+		this->_used_files.insert(file_name);
+
+		file_it = this->_collection_files.emplace(scene_collection, std::move(file_name)).first;
+	}
+
+	return file_it->second;
+}
+
+std::string StvTreeStorage::CreateFileName(const char *scene_collection) const
+{
+	// Collection names may contain any character. File names are lower case, so that they don't collide
+	// on case-insensitive file systems
+	static constexpr size_t MAX_BASE_NAME_LENGTH = 64;
+
+	std::string base_name;
+	for(const char *c = scene_collection; *c && base_name.size() < MAX_BASE_NAME_LENGTH; ++c)
+	{
+		const unsigned char character = (unsigned char)*c;
+		base_name += (std::isalnum(character) || character == '-' || character == '_') ? (char)std::tolower(character) : '_';
+	}
+
+	if(base_name.empty())
+		base_name = "collection";
+
+	std::string file_name = base_name + ".json";
+	for(int i = 2; this->_used_files.count(file_name); ++i)
+		file_name = base_name + "_" + std::to_string(i) + ".json";
+
+	return file_name;
+}
+
+void StvTreeStorage::RemoveTreeFiles(const std::string &file_name)
+{
+	this->_used_files.erase(file_name);
+
+	os_dir_t *tree_dir = os_opendir(this->_tree_dir.c_str());
+	if(!tree_dir)
+		return;
+
+	// Backups, journals and images are removed along with the tree file, unless another collection's file has the same prefix
+	for(struct os_dirent *entry = os_readdir(tree_dir); entry; entry = os_readdir(tree_dir))
+	{
+		const std::string path_name = entry->d_name;
+		if(entry->directory || !IsCollectionFile(path_name, file_name) ||
+		        std::any_of(this->_used_files.begin(), this->_used_files.end(), [&path_name](const std::string &used_file) {
+		            return IsCollectionFile(path_name, used_file);
+		        }))
+			continue;
+
+		const std::string path = this->GetTreePath(path_name);
+		if(os_unlink(path.c_str()) != 0)
+			blog(LOG_WARNING, "[%s] Failed to remove replaced scene tree file '%s'", obs_module_name(), path.c_str());
+	}
+
+	os_closedir(tree_dir);
+}
+
+bool StvTreeStorage::IsCollectionFile(const std::string &path_name, const std::string &file_name)
+{
+	// Backups, journals and images of a tree are named '<tree file>.<suffix>'
+	return path_name.compare(0, file_name.size(), file_name) == 0 &&
+	       (path_name.size() == file_name.size() || path_name[file_name.size()] == '.');
+}
+
+bool StvTreeStorage::ReadManifest()
+{
+	this->_collection_files.clear();
+	this->_used_files.clear();
+	this->_missing_collections.clear();
+	this->_previously_missing_collections.clear();
+
+	// Tree files are named after their collection, a collection named like the manifest mustn't overwrite it
+	this->_used_files.insert(MANIFEST_FILE.data());
+
+	const std::string manifest_path = this->GetTreePath(MANIFEST_FILE.data());
+	OBSDataAutoRelease manifest = obs_data_create_from_json_file_safe(manifest_path.c_str(), "bak");
+	if(!manifest)
+		return false;
+
+	OBSDataAutoRelease collections = obs_data_get_obj(manifest, MANIFEST_COLLECTIONS.data());
+	for(obs_data_item_t *item = obs_data_first(collections); item; obs_data_item_next(&item))
+	{
+		if(obs_data_item_gettype(item) != OBS_DATA_STRING)
+			continue;
+
+		std::string file_name = obs_data_item_get_string(item);
+		if(file_name == MANIFEST_FILE)
+			continue;
+
+		this->_used_files.insert(file_name);
+		this->_collection_files.emplace(obs_data_item_get_name(item), std::move(file_name));
+	}
+
+	// Collections marked as missing by a previous session are removed if they're still missing
+	OBSDataAutoRelease missing_collections = obs_data_get_obj(manifest, MANIFEST_MISSING.data());
+	for(obs_data_item_t *item = obs_data_first(missing_collections); item; obs_data_item_next(&item))
+	{
+		const char *scene_collection = obs_data_item_get_name(item);
+		if(!this->_collection_files.count(scene_collection))
+			continue;
+
+		this->_missing_collections.insert(scene_collection);
+		this->_previously_missing_collections.insert(scene_collection);
+	}
+
+	return true;
+}
+
+bool StvTreeStorage::WriteManifest() const
+{
+	OBSDataAutoRelease collections = obs_data_create();
+	for(const auto &collection_file : this->_collection_files)
+	{
+		obs_data_set_string(collections, collection_file.first.c_str(), collection_file.second.c_str());
+	}
+
+	OBSDataAutoRelease missing_collections = obs_data_create();
+	for(const auto &scene_collection : this->_missing_collections)
+	{
+		if(this->_collection_files.count(scene_collection))
+			obs_data_set_bool(missing_collections, scene_collection.c_str(), true);
+	}
+
+	OBSDataAutoRelease manifest = obs_data_create();
+	obs_data_set_int(manifest, MANIFEST_VERSION.data(), STORAGE_VERSION);
+	obs_data_set_obj(manifest, MANIFEST_COLLECTIONS.data(), collections);
+	obs_data_set_obj(manifest, MANIFEST_MISSING.data(), missing_collections);
+
+	const std::string manifest_path = this->GetTreePath(MANIFEST_FILE.data());
+	if(!obs_data_save_json_safe(manifest, manifest_path.c_str(), "tmp", "bak"))
+	{
+		blog(LOG_WARNING, "[%s] Failed to save scene tree manifest '%s'", obs_module_name(), manifest_path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void StvTreeStorage::MigrateLegacyFile()
+{
+	BPtr<char> legacy_path = obs_module_config_path(LEGACY_CONFIG_FILE.data());
+	OBSDataAutoRelease legacy_data = os_file_exists(legacy_path) ? obs_data_create_from_json_file(legacy_path) : nullptr;
+	if(!legacy_data)
+	{
+		// Nothing to migrate, start with an empty manifest
+		this->WriteManifest();
+		return;
+	}
+
+	// Split the combined file into one file per collection
+	bool migrated = true;
+	size_t collection_count = 0;
+	for(obs_data_item_t *item = obs_data_first(legacy_data); item; obs_data_item_next(&item))
+	{
+		if(obs_data_item_gettype(item) != OBS_DATA_ARRAY)
+			continue;
+
+		const char *scene_collection = obs_data_item_get_name(item);
+		OBSDataArrayAutoRelease folder_data = obs_data_item_get_array(item);
+
+		OBSDataAutoRelease tree_data = obs_data_create();
+		obs_data_set_array(tree_data, scene_collection, folder_data);
+
+		const std::string tree_path = this->GetTreePath(this->GetCollectionFile(scene_collection));
+		if(!obs_data_save_json_safe(tree_data, tree_path.c_str(), "tmp", "bak"))
+		{
+			blog(LOG_WARNING, "[%s] Failed to migrate scene tree of '%s' to '%s'", obs_module_name(), scene_collection, tree_path.c_str());
+			migrated = false;
+		}
+
+		++collection_count;
+	}
+
+	// Keep the combined file until all collections were written, the migration is retried on the next start otherwise
+	if(!migrated || !this->WriteManifest())
+		return;
+
+	const std::string backup_path = std::string(legacy_path.Get()) + ".bak";
+	if(os_rename(legacy_path, backup_path.c_str()) != 0)
+		blog(LOG_WARNING, "[%s] Failed to rename '%s' after migration", obs_module_name(), legacy_path.Get());
+
+	blog(LOG_INFO, "[%s] Migrated scene trees of %zu collections from '%s'", obs_module_name(), collection_count, legacy_path.Get());
+}
+
+void StvTreeStorage::WriteTree(const tree_write_t &tree_write)
+{
+	// Runs on the writer thread, only uses the data of the write
+	OBSDataAutoRelease tree_data;
+	bool is_written;
+
+	if(tree_write.BinaryFormat)
+	{
+		const QByteArray image_data = tree_write.Snapshot.CreateImage(tree_write.Generation);
+
+		// Like the JSON files, the image is replaced only once it was written completely
+		QSaveFile image_file(QString::fromStdString(tree_write.ImagePath));
+		is_written = image_file.open(QIODevice::WriteOnly) && image_file.write(image_data) == image_data.size() && image_file.commit();
+	}
+	else
+	{
+		OBSDataArrayAutoRelease root_folder_data = tree_write.Snapshot.CreateFolderArray();
+
+		tree_data = obs_data_create();
+		obs_data_set_array(tree_data, tree_write.SceneCollection.c_str(), root_folder_data);
+		obs_data_set_int(tree_data, JOURNAL_GENERATION.data(), tree_write.Generation);
+
+		is_written = obs_data_save_json_safe(tree_data, tree_write.TreePath.c_str(), "tmp", "bak");
+	}
+
+	const std::string &written_path = tree_write.BinaryFormat ? tree_write.ImagePath : tree_write.TreePath;
+	if(!is_written)
+	{
+		blog(LOG_WARNING, "[%s] Failed to save scene tree in '%s'", obs_module_name(), written_path.c_str());
+		return;
+	}
+
+	// Only the file of the saved format is kept
+	RemoveFile(tree_write.BinaryFormat ? tree_write.TreePath : tree_write.ImagePath);
+
+	// The edits of previous journals are part of the written tree
+	for(long long generation = tree_write.Generation - 1; generation >= 0; --generation)
+	{
+		const std::string journal_path = GetJournalPath(tree_write.TreePath, generation);
+		if(!os_file_exists(journal_path.c_str()))
+			break;
+
+		os_unlink(journal_path.c_str());
+	}
+
+	if(tree_data)
+	{
+		std::lock_guard<std::mutex> lock(this->_written_mutex);
+		this->_written_trees[tree_write.SceneCollection] = written_tree_t{OBSData(tree_data.Get()), tree_write.Generation};
+	}
+}
+
+void StvTreeStorage::StartJournal(const std::string &file_name, journal_t &journal) const
+{
+	journal = journal_t{journal.Generation + 1};
+
+	if(this->_journal_enabled)
+		this->ResetJournal(GetJournalPath(this->GetTreePath(file_name), journal.Generation), journal);
+}
+
+bool StvTreeStorage::ResetJournal(const std::string &journal_path, journal_t &journal) const
+{
+	OBSDataAutoRelease header = obs_data_create();
+	obs_data_set_int(header, JOURNAL_HEADER_GENERATION.data(), journal.Generation);
+
+	std::string line = obs_data_get_json(header);
+	line += '\n';
+
+	if(!os_quick_write_utf8_file(journal_path.c_str(), line.data(), line.size(), false))
+	{
+		blog(LOG_WARNING, "[%s] Failed to create scene tree journal '%s'", obs_module_name(), journal_path.c_str());
+		return false;
+	}
+
+	journal.Size = line.size();
+	journal.IsOpen = true;
+	return true;
+}
+
+bool StvTreeStorage::IsJournalEmpty(const std::string &tree_path, journal_t &journal) const
+{
+	// A journal of the next generation exists if writing a tree failed or was interrupted
+	if(os_file_exists(GetJournalPath(tree_path, journal.Generation + 1).c_str()))
+		return false;
+
+	const std::string journal_path = GetJournalPath(tree_path, journal.Generation);
+	BPtr<char> journal_text = os_file_exists(journal_path.c_str()) ? os_quick_read_utf8_file(journal_path.c_str()) : nullptr;
+	if(!journal_text)
+		return true;
+
+	// Incomplete journals and journals of other generations are replaced on the next save
+	const std::string_view text = journal_text.Get();
+	const size_t header_end = text.find('\n');
+	if(header_end == std::string_view::npos)
+		return true;
+
+	OBSDataAutoRelease header = obs_data_create_from_json(std::string(text.substr(0, header_end)).c_str());
+	if(!header || obs_data_get_int(header, JOURNAL_HEADER_GENERATION.data()) != journal.Generation)
+		return true;
+
+	if(header_end + 1 < text.size())
+		return false;
+
+	journal.Size = text.size();
+	journal.IsOpen = true;
+	return true;
+}
+
+void StvTreeStorage::ReplayJournals(const std::string &tree_path, obs_data_array_t *root_folder_data, journal_t &journal) const
+{
+	tree_index_t tree_index;
+	IndexFolder(root_folder_data, tree_index);
+
+	// Journals of later generations exist if writing a tree failed or was interrupted. Their edits follow the
+	// edits of the previous journal
+	for(long long generation = journal.Generation;; ++generation)
+	{
+		const std::string journal_path = GetJournalPath(tree_path, generation);
+		if(!os_file_exists(journal_path.c_str()))
+			break;
+
+		journal = journal_t{generation};
+		if(!this->ReplayJournal(journal_path, root_folder_data, tree_index, journal))
+			break;
+	}
+}
+
+bool StvTreeStorage::ReplayJournal(const std::string &journal_path, obs_data_array_t *root_folder_data, tree_index_t &tree_index,
+                                   journal_t &journal) const
+{
+	BPtr<char> journal_text = os_quick_read_utf8_file(journal_path.c_str());
+	if(!journal_text)
+		return false;
+
+	const std::string_view text = journal_text.Get();
+
+	size_t edit_count = 0;
+	bool is_complete = true;
+
+	size_t line_start = 0;
+	for(size_t line_end = text.find('\n'); line_end != std::string_view::npos; line_end = text.find('\n', line_start))
+	{
+		const std::string line(text.substr(line_start, line_end - line_start));
+		OBSDataAutoRelease line_data = obs_data_create_from_json(line.c_str());
+
+		if(line_start == 0)
+		{
+			if(!line_data || obs_data_get_int(line_data, JOURNAL_HEADER_GENERATION.data()) != journal.Generation)
+				return false;
+		}
+		else if(!line_data || !ApplyOperation(root_folder_data, tree_index, line_data))
+		{
+			is_complete = false;
+			break;
+		}
+		else
+			++edit_count;
+
+		line_start = line_end + 1;
+	}
+
+	// A partially written edit can only be the last line
+	if(line_start < text.size())
+		is_complete = false;
+
+	if(!is_complete)
+		blog(LOG_WARNING, "[%s] Scene tree journal '%s' is incomplete, dropped edits after line %zu", obs_module_name(),
+		     journal_path.c_str(), edit_count + 1);
+
+	blog(LOG_INFO, "[%s] Replayed %zu scene tree edits from '%s'", obs_module_name(), edit_count, journal_path.c_str());
+
+	// Only append to journals that end with a complete line
+	journal.Size = line_start;
+	journal.HasEdits = edit_count > 0;
+	journal.IsOpen = is_complete;
+
+	return is_complete;
+}
+
+void StvTreeStorage::IndexFolder(obs_data_array_t *folder_data, tree_index_t &tree_index)
+{
+	const size_t item_count = obs_data_array_count(folder_data);
+	for(size_t i = 0; i < item_count; ++i)
+	{
+		OBSDataAutoRelease item_data = obs_data_array_item(folder_data, i);
+
+		const uint64_t node_id = (uint64_t)obs_data_get_int(item_data, StvItemModel::SCENE_TREE_CONFIG_NODE_ID_DATA.data());
+		if(node_id)
+			tree_index[node_id] = tree_node_t{OBSData(item_data.Get()), OBSDataArray(folder_data)};
+
+		OBSDataArrayAutoRelease sub_folder_data = obs_data_get_array(item_data, StvItemModel::SCENE_TREE_CONFIG_FOLDER_DATA.data());
+		if(sub_folder_data)
+			IndexFolder(sub_folder_data, tree_index);
+	}
+}
+
+obs_data_array_t *StvTreeStorage::GetFolderData(obs_data_array_t *root_folder_data, const tree_index_t &tree_index, uint64_t node_id)
+{
+	if(!node_id)
+	{
+		obs_data_array_addref(root_folder_data);
+		return root_folder_data;
+	}
+
+	const auto node_it = tree_index.find(node_id);
+	if(node_it == tree_index.end())
+		return nullptr;
+
+	return obs_data_get_array(node_it->second.Item, StvItemModel::SCENE_TREE_CONFIG_FOLDER_DATA.data());
+}
+
+bool StvTreeStorage::ApplyOperation(obs_data_array_t *root_folder_data, tree_index_t &tree_index, obs_data_t *operation)
+{
+	const std::string_view type = obs_data_get_string(operation, StvItemModel::TREE_EDIT_OPERATION.data());
+	const uint64_t node_id = (uint64_t)obs_data_get_int(operation, StvItemModel::SCENE_TREE_CONFIG_NODE_ID_DATA.data());
+	const uint64_t parent_id = (uint64_t)obs_data_get_int(operation, StvItemModel::TREE_EDIT_PARENT.data());
+	const long long row = obs_data_get_int(operation, StvItemModel::TREE_EDIT_ROW.data());
+
+	if(type == StvItemModel::TREE_EDIT_CREATE)
+	{
+		OBSDataArrayAutoRelease parent_data = GetFolderData(root_folder_data, tree_index, parent_id);
+		if(!parent_data || !node_id)
+			return false;
+
+		OBSDataAutoRelease item_data = obs_data_create();
+		if(obs_data_get_bool(operation, StvItemModel::TREE_EDIT_IS_FOLDER.data()))
+		{
+			OBSDataArrayAutoRelease sub_folder_data = obs_data_array_create();
+			obs_data_set_array(item_data, StvItemModel::SCENE_TREE_CONFIG_FOLDER_DATA.data(), sub_folder_data);
+			obs_data_set_bool(item_data, StvItemModel::SCENE_TREE_CONFIG_FOLDER_EXPANDED.data(), false);
+		}
+
+		obs_data_set_string(item_data, StvItemModel::SCENE_TREE_CONFIG_ITEM_NAME_DATA.data(),
+		                    obs_data_get_string(operation, StvItemModel::SCENE_TREE_CONFIG_ITEM_NAME_DATA.data()));
+		obs_data_set_int(item_data, StvItemModel::SCENE_TREE_CONFIG_NODE_ID_DATA.data(), (long long)node_id);
+		if(obs_data_has_user_value(operation, StvItemModel::SCENE_TREE_CONFIG_SCENE_UUID_DATA.data()))
+		{
+			obs_data_set_string(item_data, StvItemModel::SCENE_TREE_CONFIG_SCENE_UUID_DATA.data(),
+			                    obs_data_get_string(operation, StvItemModel::SCENE_TREE_CONFIG_SCENE_UUID_DATA.data()));
+		}
+
+		InsertItem(parent_data, row, item_data);
+		tree_index[node_id] = tree_node_t{OBSData(item_data.Get()), OBSDataArray(parent_data.Get())};
+
+		return true;
+	}
+	else if(type == StvItemModel::TREE_EDIT_MOVE)
+	{
+		OBSDataArrayAutoRelease parent_data = GetFolderData(root_folder_data, tree_index, parent_id);
+		OBSDataArrayAutoRelease moved_items = obs_data_get_array(operation, StvItemModel::TREE_EDIT_ITEMS.data());
+		if(!parent_data || !moved_items)
+			return false;
+
+		// Take out all items before inserting them, like StvItemModel::moveRows()
+		std::vector<tree_node_t*> moved_nodes;
+		const size_t item_count = obs_data_array_count(moved_items);
+		for(size_t i = 0; i < item_count; ++i)
+		{
+			OBSDataAutoRelease moved_item = obs_data_array_item(moved_items, i);
+			const auto node_it = tree_index.find((uint64_t)obs_data_get_int(moved_item, StvItemModel::SCENE_TREE_CONFIG_NODE_ID_DATA.data()));
+			if(node_it == tree_index.end() || !EraseItem(node_it->second.Parent, node_it->second.Item))
+				return false;
+
+			moved_nodes.push_back(&node_it->second);
+		}
+
+		for(size_t i = 0; i < moved_nodes.size(); ++i)
+		{
+			InsertItem(parent_data, row + (long long)i, moved_nodes[i]->Item);
+			moved_nodes[i]->Parent = parent_data.Get();
+		}
+
+		return true;
+	}
+
+	const auto node_it = tree_index.find(node_id);
+	if(node_it == tree_index.end())
+		return false;
+
+	if(type == StvItemModel::TREE_EDIT_RENAME)
+	{
+		obs_data_set_string(node_it->second.Item, StvItemModel::SCENE_TREE_CONFIG_ITEM_NAME_DATA.data(),
+		                    obs_data_get_string(operation, StvItemModel::SCENE_TREE_CONFIG_ITEM_NAME_DATA.data()));
+	}
+	else if(type == StvItemModel::TREE_EDIT_EXPAND)
+	{
+		obs_data_set_bool(node_it->second.Item, StvItemModel::SCENE_TREE_CONFIG_FOLDER_EXPANDED.data(),
+		                  obs_data_get_bool(operation, StvItemModel::SCENE_TREE_CONFIG_FOLDER_EXPANDED.data()));
+	}
+	else if(type == StvItemModel::TREE_EDIT_DELETE)
+	{
+		// Children of deleted folders stay indexed, but are no longer part of the tree
+		if(!EraseItem(node_it->second.Parent, node_it->second.Item))
+			return false;
+
+		tree_index.erase(node_it);
+	}
+	else
+		return false;
+
+	return true;
+}
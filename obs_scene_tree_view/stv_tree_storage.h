@@ -0,0 +1,198 @@
+#ifndef STV_TREE_STORAGE_H
+#define STV_TREE_STORAGE_H
+
+#include "obs_scene_tree_view/stv_tree_image.h"
+#include "obs_scene_tree_view/stv_tree_writer.h"
+
+#include <obs.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+
+// Stores the tree of each scene collection in its own file. A small manifest maps collection names to files,
+// so saving or loading a tree only touches the file of that collection
+class StvTreeStorage
+{
+	public:
+		static constexpr std::string_view LEGACY_CONFIG_FILE = "scene_tree.json";
+		static constexpr std::string_view TREE_DIR = "scene_trees";
+		static constexpr std::string_view MANIFEST_FILE = "manifest.json";
+		static constexpr std::string_view MANIFEST_COLLECTIONS = "collections";
+		static constexpr std::string_view MANIFEST_VERSION = "version";
+
+		// Collections that OBS didn't list while their tree was kept
+		static constexpr std::string_view MANIFEST_MISSING = "missing";
+		static constexpr int STORAGE_VERSION = 1;
+
+		// Edits made after a tree was saved are appended to '<tree file>.<generation>.journal'. The first line of the
+		// journal holds the generation of the tree file it belongs to, each further line one edit. Saving starts the
+		// journal of the next generation, journals of previous generations are removed once the tree was written
+		static constexpr std::string_view JOURNAL_EXTENSION = ".journal";
+		static constexpr std::string_view JOURNAL_GENERATION = "journal_generation";
+		static constexpr std::string_view JOURNAL_HEADER_GENERATION = "generation";
+
+		// Journals larger than this are folded into the tree file
+		static constexpr size_t JOURNAL_COMPACTION_SIZE = 64*1024;
+
+		// Reads the manifest. Migrates the combined file of previous versions if no manifest exists yet
+		void Open();
+
+		// Reads the manifest of the trees in tree_dir. Returns false if there is none yet, nothing is migrated then
+		bool Open(const char *tree_dir);
+
+		// Moves the tree of a renamed collection to its new name. The tree file itself is kept, the files of a tree
+		// previously saved under the new name are removed
+		bool RenameCollection(const char *old_name, const char *new_name);
+
+		// Removes the manifest entries of collections that no longer exist together with their files, and logs
+		// the size of the remaining files. Collections may only be missing temporarily, e.g. if OBS couldn't read
+		// them. Their trees are kept until they're still missing after OBS was restarted. Files that aren't listed
+		// in the manifest are never removed
+		void CollectGarbage(const std::unordered_set<std::string> &scene_collections);
+
+		// Parses the tree of the collection on the writer thread, LoadTree() then only applies its journal. Trees saved
+		// as images aren't preloaded, they're mapped when they're loaded
+		void PreloadTree(const char *scene_collection);
+
+		// Returns the saved data of the collection with its journal applied, nullptr if none was saved.
+		// Parsed trees stay in memory until their file changes on disk. Must be released by the caller and
+		// must not be modified
+		obs_data_t *LoadTree(const char *scene_collection);
+
+		// The snapshot is written on a background thread. Trees are loaded only after pending writes finished
+		bool SaveTree(const char *scene_collection, StvTreeSnapshot &&snapshot);
+		void WaitForWrites();
+
+		// Trees are saved as images instead of JSON files if enabled. Either format is loaded, whichever was saved last
+		void SetBinaryFormat(bool enabled);
+		bool IsBinaryFormat() const
+		{	return this->_binary_format;	}
+
+		// Maps the image of the collection. Returns false if the tree isn't saved as an image or has journaled edits,
+		// LoadTree() has to be used then
+		bool LoadTreeImage(const char *scene_collection, StvTreeImage &tree_image);
+
+		void SetJournalEnabled(bool enabled);
+		bool IsJournalEnabled() const
+		{	return this->_journal_enabled;	}
+
+		// Continues the journal of the loaded tree, creates it if the tree has none yet. Returns false if edits can't
+		// be appended to it, the tree has to be saved in full then
+		bool ContinueJournal(const char *scene_collection);
+
+		// Returns false if the edit couldn't be written. The tree has to be saved in full then
+		bool AppendJournal(const char *scene_collection, obs_data_t *operation);
+		bool NeedsCompaction(const char *scene_collection) const;
+
+	private:
+		struct journal_t
+		{
+			long long Generation = 0;
+			size_t Size = 0;
+			bool IsOpen = false;
+			bool HasEdits = false;
+		};
+
+		// Everything the writer thread needs to write a tree
+		struct tree_write_t
+		{
+			std::string SceneCollection;
+			std::string TreePath;
+			std::string ImagePath;
+			long long Generation;
+			bool BinaryFormat;
+			StvTreeSnapshot Snapshot;
+		};
+
+		struct written_tree_t
+		{
+			OBSData Data;
+			long long Generation;
+		};
+
+		struct file_stat_t
+		{
+			int64_t Size = -1;
+			int64_t ModifiedTime = 0;		// In ticks of the file system clock
+
+			bool operator==(const file_stat_t &other) const
+			{	return this->Size == other.Size && this->ModifiedTime == other.ModifiedTime;	}
+		};
+
+		// Parsed tree of a collection, as it was last read or written
+		struct resident_tree_t
+		{
+			OBSData Data;
+			file_stat_t FileStat;
+		};
+
+		struct tree_node_t
+		{
+			OBSData Item;
+			OBSDataArray Parent;
+		};
+
+		using tree_index_t = std::unordered_map<uint64_t, tree_node_t>;
+
+		std::string _tree_dir;
+		std::unordered_map<std::string, std::string> _collection_files;
+		std::unordered_set<std::string> _used_files;
+
+		// Collections that are missing from the scene collection list, and those that were missing already
+		// when the manifest was read
+		std::unordered_set<std::string> _missing_collections;
+		std::unordered_set<std::string> _previously_missing_collections;
+
+		bool _binary_format = false;
+		bool _journal_enabled = false;
+		std::unordered_map<std::string, journal_t> _journals;
+
+		std::unordered_map<std::string, resident_tree_t> _resident_trees;
+
+		// JSON trees that were written by the writer thread, they become resident trees in WaitForWrites()
+		std::mutex _written_mutex;
+		std::unordered_map<std::string, written_tree_t> _written_trees;
+
+		// Trees parsed by PreloadTree(), without their journal. Guarded by _written_mutex as well
+		std::unordered_map<std::string, resident_tree_t> _preloaded_trees;
+
+		// Declared last, so that the thread finishes its writes before any other member is destroyed
+		StvTreeWriter _writer;
+
+		std::string GetTreePath(const std::string &file_name) const;
+		static std::string GetJournalPath(const std::string &tree_path, long long generation);
+		std::string GetImagePath(const std::string &file_name) const;
+		bool UsesImage(const std::string &file_name) const;
+		obs_data_t *CreateTreeData(const char *scene_collection, const std::string &image_path) const;
+		static bool GetFileStat(const std::string &path, file_stat_t &file_stat);
+		void SetResidentTree(const char *scene_collection, obs_data_t *tree_data, const std::string &tree_path);
+		obs_data_t *TakePreloadedTree(const char *scene_collection, const std::string &tree_path);
+		const std::string &GetCollectionFile(const char *scene_collection);
+		std::string CreateFileName(const char *scene_collection) const;
+		static bool IsCollectionFile(const std::string &path_name, const std::string &file_name);
+		void RemoveTreeFiles(const std::string &file_name);
+
+		bool ReadManifest();
+		bool WriteManifest() const;
+		void MigrateLegacyFile();
+
+		void WriteTree(const tree_write_t &tree_write);
+
+		void StartJournal(const std::string &file_name, journal_t &journal) const;
+		bool ResetJournal(const std::string &journal_path, journal_t &journal) const;
+		bool IsJournalEmpty(const std::string &tree_path, journal_t &journal) const;
+		void ReplayJournals(const std::string &tree_path, obs_data_array_t *root_folder_data, journal_t &journal) const;
+		bool ReplayJournal(const std::string &journal_path, obs_data_array_t *root_folder_data, tree_index_t &tree_index,
+		                   journal_t &journal) const;
+
+		static void IndexFolder(obs_data_array_t *folder_data, tree_index_t &tree_index);
+		static obs_data_array_t *GetFolderData(obs_data_array_t *root_folder_data, const tree_index_t &tree_index, uint64_t node_id);
+		static bool ApplyOperation(obs_data_array_t *root_folder_data, tree_index_t &tree_index, obs_data_t *operation);
+};
+
+#endif //STV_TREE_STORAGE_H
@@ -0,0 +1,69 @@
+#include "obs_scene_tree_view/stv_tree_writer.h"
+
+#include <util/threading.h>
+
+#include <algorithm>
+
+
+StvTreeWriter::StvTreeWriter()
+    : _thread(&StvTreeWriter::Run, this)
+{}
+
+StvTreeWriter::~StvTreeWriter()
+{
+	// Finish all queued writes before the thread exits
+	{
+		std::lock_guard<std::mutex> lock(this->_mutex);
+		this->_is_stopping = true;
+	}
+
+	this->_job_added.notify_one();
+	this->_thread.join();
+}
+
+void StvTreeWriter::Submit(const std::string &file_name, write_job_t &&job)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->_mutex);
+
+		const auto job_it = std::find_if(this->_jobs.begin(), this->_jobs.end(),
+		                                 [&file_name](const queued_job_t &queued_job) { return queued_job.FileName == file_name; });
+		if(job_it != this->_jobs.end())
+			job_it->Job = std::move(job);
+		else
+			this->_jobs.push_back(queued_job_t{file_name, std::move(job)});
+	}
+
+	this->_job_added.notify_one();
+}
+
+void StvTreeWriter::Wait()
+{
+	std::unique_lock<std::mutex> lock(this->_mutex);
+	this->_jobs_done.wait(lock, [this]() { return this->_jobs.empty() && !this->_is_writing; });
+}
+
+void StvTreeWriter::Run()
+{
+	os_set_thread_name("stv_tree_writer");
+
+	std::unique_lock<std::mutex> lock(this->_mutex);
+	while(true)
+	{
+		this->_job_added.wait(lock, [this]() { return !this->_jobs.empty() || this->_is_stopping; });
+		if(this->_jobs.empty())
+			break;
+
+		write_job_t job = std::move(this->_jobs.front().Job);
+		this->_jobs.pop_front();
+		this->_is_writing = true;
+
+		lock.unlock();
+		job();
+		lock.lock();
+
+		this->_is_writing = false;
+		if(this->_jobs.empty())
+			this->_jobs_done.notify_all();
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef STV_TREE_WRITER_H
+#define STV_TREE_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+// Runs file writes, and the reads of preloaded trees, on a background thread, one at a time and in the order they were submitted
+class StvTreeWriter
+{
+	public:
+		using write_job_t = std::function<void()>;
+
+		StvTreeWriter();
+		~StvTreeWriter();
+
+		// Replaces a job for the same file that didn't start yet. A newer job therefore never runs before an older one,
+		// and outdated trees that weren't written yet are skipped
+		void Submit(const std::string &file_name, write_job_t &&job);
+
+		// Blocks until all submitted jobs finished
+		void Wait();
+
+	private:
+		struct queued_job_t
+		{
+			std::string FileName;
+			write_job_t Job;
+		};
+
+		std::mutex _mutex;
+		std::condition_variable _job_added;
+		std::condition_variable _jobs_done;
+
+		std::deque<queued_job_t> _jobs;
+		bool _is_writing = false;
+		bool _is_stopping = false;
+
+		std::thread _thread;
+
+		void Run();
+};
+
+#endif //STV_TREE_WRITER_H
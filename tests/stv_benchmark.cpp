@@ -0,0 +1,287 @@
+#include "stv_test_frontend.h"
+
+#include "obs_scene_tree_view/stv_item_model.h"
+#include "obs_scene_tree_view/stv_tree_image.h"
+
+#include <util/platform.h>
+
+#include <QCoreApplication>
+#include <QSaveFile>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+static constexpr int RUNS = 5;
+static constexpr size_t SCENES_PER_FOLDER = 100;
+static constexpr const char *SCENE_COLLECTION = "Benchmark Collection";
+
+// Keeps lookups from being optimized away
+static volatile size_t lookup_sink = 0;
+
+// Best time of several runs in milliseconds
+static double MeasureMs(const std::function<void()> &run)
+{
+	uint64_t best_ns = UINT64_MAX;
+	for(int i = 0; i < RUNS; ++i)
+	{
+		const uint64_t start_ns = os_gettime_ns();
+		run();
+		best_ns = std::min(best_ns, os_gettime_ns() - start_ns);
+	}
+
+	return best_ns / 1000000.0;
+}
+
+static std::vector<OBSSource> CreateScenes(size_t scene_count)
+{
+	std::vector<OBSSource> scenes;
+	scenes.reserve(scene_count);
+	for(size_t i = 0; i < scene_count; ++i)
+	{
+		OBSSceneAutoRelease scene = obs_scene_create(("Scene " + std::to_string(i)).c_str());
+		scenes.emplace_back(obs_scene_get_source(scene));
+	}
+
+	return scenes;
+}
+
+struct saved_scene_t
+{
+	std::string Name;
+	std::string Uuid;
+};
+
+static std::vector<saved_scene_t> GetSavedScenes(const std::vector<OBSSource> &scenes)
+{
+	std::vector<saved_scene_t> saved_scenes;
+	saved_scenes.reserve(scenes.size());
+	for(const auto &scene : scenes)
+		saved_scenes.push_back(saved_scene_t{obs_source_get_name(scene), obs_source_get_uuid(scene)});
+
+	return saved_scenes;
+}
+
+// Saved tree with the scenes in folders of SCENES_PER_FOLDER scenes
+static StvTreeSnapshot CreateTreeSnapshot(const std::vector<saved_scene_t> &saved_scenes, bool is_expanded)
+{
+	StvTreeSnapshot snapshot;
+
+	uint64_t node_id = 0;
+	for(size_t first = 0; first < saved_scenes.size(); first += SCENES_PER_FOLDER)
+	{
+		snapshot.BeginFolder("Folder " + std::to_string(first / SCENES_PER_FOLDER), ++node_id, is_expanded);
+		for(size_t i = first; i < std::min(first + SCENES_PER_FOLDER, saved_scenes.size()); ++i)
+			snapshot.AddScene(saved_scenes[i].Name, saved_scenes[i].Uuid, ++node_id);
+
+		snapshot.EndFolder();
+	}
+
+	return snapshot;
+}
+
+// Scene index of previous versions, every comparison took strong references of both scenes
+struct legacy_scene_comp_t
+{
+	bool operator()(obs_weak_source_t *x, obs_weak_source_t *y) const
+	{	return OBSGetStrongRef(x).Get() < OBSGetStrongRef(y).Get();	}
+};
+
+// Looks up every scene once, like a check of the scene list does, in the previous and the current index type.
+// UpdateTree() checks the whole scene list against the model's index
+static void BenchmarkSceneIndex(size_t scene_count)
+{
+	const std::vector<OBSSource> scenes = CreateScenes(scene_count);
+
+	std::vector<OBSWeakSource> weak_scenes;
+	std::map<obs_weak_source_t*, size_t, legacy_scene_comp_t> legacy_index;
+	std::unordered_map<obs_source_t*, OBSWeakSource> scene_index;
+	for(size_t i = 0; i < scenes.size(); ++i)
+	{
+		weak_scenes.push_back(OBSGetWeakRef(scenes[i]));
+		legacy_index.emplace(weak_scenes.back(), i);
+		scene_index.emplace(scenes[i], weak_scenes.back());
+	}
+
+	const double legacy_ms = MeasureMs([&scenes, &legacy_index]() {
+		for(const auto &scene : scenes)
+		{
+			OBSWeakSource weak = OBSGetWeakRef(scene);
+			lookup_sink = lookup_sink + legacy_index.count(weak);
+		}
+	});
+
+	const double hashed_ms = MeasureMs([&scenes, &scene_index]() {
+		for(const auto &scene : scenes)
+		{
+			const auto scene_it = scene_index.find(scene);
+			lookup_sink = lookup_sink + (scene_it != scene_index.end() && obs_weak_source_references_source(scene_it->second, scene));
+		}
+	});
+
+	SetFrontendScenes(scenes);
+
+	obs_frontend_source_list scene_list = {};
+	obs_frontend_get_scenes(&scene_list);
+
+	double update_ms;
+	{
+		// The first check adds all scenes to the tree, later checks find them in the index
+		StvItemModel model;
+		model.UpdateTree(scene_list, QModelIndex());
+		update_ms = MeasureMs([&model, &scene_list]() {
+			model.UpdateTree(scene_list, QModelIndex());
+		});
+	}
+
+	obs_frontend_source_list_free(&scene_list);
+	SetFrontendScenes({});
+
+	std::printf("%8zu scenes: map with strong refs %9.3f ms, hashed index %9.3f ms, UpdateTree() %9.3f ms\n", scene_count,
+	            legacy_ms, hashed_ms, update_ms);
+}
+
+// Loads a saved tree. Previous versions looked up every saved scene by name, the loader resolves them against
+// one snapshot of the scene list. Nodes of collapsed folders are only created once they're expanded
+static void BenchmarkTreeLoad(size_t scene_count)
+{
+	const std::vector<OBSSource> scenes = CreateScenes(scene_count);
+	const std::vector<saved_scene_t> saved_scenes = GetSavedScenes(scenes);
+	SetFrontendScenes(scenes);
+
+	const double lookup_ms = MeasureMs([&saved_scenes]() {
+		for(const auto &saved_scene : saved_scenes)
+		{
+			OBSSourceAutoRelease source = obs_get_source_by_name(saved_scene.Name.c_str());
+			lookup_sink = lookup_sink + (source != nullptr);
+		}
+	});
+
+	double load_ms[2];
+	for(const bool is_expanded : {true, false})
+	{
+		OBSDataArrayAutoRelease folder_array = CreateTreeSnapshot(saved_scenes, is_expanded).CreateFolderArray();
+		OBSDataAutoRelease tree_data = obs_data_create();
+		obs_data_set_array(tree_data, SCENE_COLLECTION, folder_array);
+
+		StvItemModel model;
+		load_ms[is_expanded] = MeasureMs([&model, &tree_data]() {
+			model.LoadSceneTree(tree_data, SCENE_COLLECTION);
+		});
+	}
+
+	SetFrontendScenes({});
+
+	std::printf("%8zu scenes: lookups by name %9.3f ms, LoadSceneTree() expanded %9.3f ms, collapsed %9.3f ms\n", scene_count,
+	            lookup_ms, load_ms[true], load_ms[false]);
+}
+
+static size_t ReadJsonFolder(obs_data_array_t *folder_data)
+{
+	size_t node_count = 0;
+
+	const size_t item_count = obs_data_array_count(folder_data);
+	for(size_t i = 0; i < item_count; ++i)
+	{
+		OBSDataAutoRelease item_data = obs_data_array_item(folder_data, i);
+		lookup_sink = lookup_sink + strlen(obs_data_get_string(item_data, StvItemModel::SCENE_TREE_CONFIG_ITEM_NAME_DATA.data()));
+		++node_count;
+
+		OBSDataArrayAutoRelease sub_folder_data = obs_data_get_array(item_data, StvItemModel::SCENE_TREE_CONFIG_FOLDER_DATA.data());
+		if(sub_folder_data)
+			node_count += ReadJsonFolder(sub_folder_data);
+	}
+
+	return node_count;
+}
+
+// Writes a tree of node_count nodes in both formats, then reads it and the name of every node. Scenes don't have
+// to exist for this, they aren't resolved
+static void BenchmarkTreeFormats(size_t node_count, const std::string &tree_dir)
+{
+	std::vector<saved_scene_t> saved_scenes(node_count - node_count / (SCENES_PER_FOLDER + 1));
+	for(size_t i = 0; i < saved_scenes.size(); ++i)
+	{
+		char uuid[37];
+		std::snprintf(uuid, sizeof(uuid), "00000000-0000-0000-0000-%012zu", i);
+		saved_scenes[i] = saved_scene_t{"Scene " + std::to_string(i), uuid};
+	}
+
+	const StvTreeSnapshot snapshot = CreateTreeSnapshot(saved_scenes, false);
+	const std::string json_path = tree_dir + "/benchmark.json";
+	const std::string image_path = tree_dir + "/benchmark" + StvTreeImage::FILE_EXTENSION.data();
+
+	// Same steps as StvTreeStorage::WriteTree()
+	const double json_write_ms = MeasureMs([&snapshot, &json_path]() {
+		OBSDataArrayAutoRelease root_folder_data = snapshot.CreateFolderArray();
+		OBSDataAutoRelease tree_data = obs_data_create();
+		obs_data_set_array(tree_data, SCENE_COLLECTION, root_folder_data);
+		obs_data_save_json_safe(tree_data, json_path.c_str(), "tmp", "bak");
+	});
+
+	const double image_write_ms = MeasureMs([&snapshot, &image_path]() {
+		const QByteArray image_data = snapshot.CreateImage(0);
+		QSaveFile image_file(QString::fromStdString(image_path));
+		if(image_file.open(QIODevice::WriteOnly) && image_file.write(image_data) == image_data.size())
+			image_file.commit();
+	});
+
+	size_t json_node_count = 0;
+	const double json_read_ms = MeasureMs([&json_path, &json_node_count]() {
+		OBSDataAutoRelease tree_data = obs_data_create_from_json_file_safe(json_path.c_str(), "bak");
+		OBSDataArrayAutoRelease root_folder_data = obs_data_get_array(tree_data, SCENE_COLLECTION);
+		json_node_count = root_folder_data ? ReadJsonFolder(root_folder_data) : 0;
+	});
+
+	size_t image_node_count = 0;
+	const double image_read_ms = MeasureMs([&image_path, &image_node_count]() {
+		StvTreeImage tree_image;
+		image_node_count = tree_image.Open(image_path) ? tree_image.NodeCount() : 0;
+		for(uint32_t i = 0; i < image_node_count; ++i)
+			lookup_sink = lookup_sink + tree_image.NodeName(tree_image.Node(i)).size();
+	});
+
+	if(json_node_count != image_node_count)
+		std::fprintf(stderr, "Read %zu nodes from the JSON file, but %zu nodes from the image\n", json_node_count, image_node_count);
+
+	std::printf("%8zu nodes: JSON %9lld bytes, write %9.3f ms, read %9.3f ms | image %9lld bytes, write %9.3f ms, read %9.3f ms\n",
+	            image_node_count, (long long)os_get_file_size(json_path.c_str()), json_write_ms, json_read_ms,
+	            (long long)os_get_file_size(image_path.c_str()), image_write_ms, image_read_ms);
+}
+
+int main(int argc, char **argv)
+{
+	QCoreApplication app(argc, argv);
+
+	if(!StartTestObs())
+	{
+		std::fprintf(stderr, "Failed to start libobs\n");
+		return 1;
+	}
+
+	std::printf("Scene index, one lookup per scene, best of %d runs\n", RUNS);
+	for(const size_t scene_count : {100, 1000, 10000})
+		BenchmarkSceneIndex(scene_count);
+
+	std::printf("\nLoading a saved tree, folders of %zu scenes, best of %d runs\n", SCENES_PER_FOLDER, RUNS);
+	for(const size_t scene_count : {1000, 10000})
+		BenchmarkTreeLoad(scene_count);
+
+	QTemporaryDir tree_dir;
+	if(tree_dir.isValid())
+	{
+		std::printf("\nTree files, JSON and image, best of %d runs\n", RUNS);
+		for(const size_t node_count : {1000, 10000, 100000})
+			BenchmarkTreeFormats(node_count, tree_dir.path().toStdString());
+	}
+
+	StopTestObs();
+	return 0;
+}
@@ -0,0 +1,86 @@
+#include "stv_test_frontend.h"
+
+#include <obs-frontend-api.h>
+#include <obs-module.h>
+#include <util/config-file.h>
+#include <util/darray.h>
+
+
+OBS_DECLARE_MODULE();
+
+MODULE_EXPORT const char *obs_module_name(void)
+{
+	return "SceneTreeViewTest";
+}
+
+static std::vector<OBSSource> frontend_scenes;
+static config_t *frontend_config = nullptr;
+
+void SetFrontendScenes(const std::vector<OBSSource> &scenes)
+{
+	frontend_scenes = scenes;
+}
+
+bool StartTestObs()
+{
+	if(!obs_startup("en-US", nullptr, nullptr))
+		return false;
+
+	// Scenes are managed if they use the base resolution
+	return config_open_string(&frontend_config, "[Video]\nBaseCX=1920\nBaseCY=1080\n") == CONFIG_SUCCESS;
+}
+
+void StopTestObs()
+{
+	frontend_scenes.clear();
+
+	config_close(frontend_config);
+	frontend_config = nullptr;
+
+	obs_shutdown();
+}
+
+void *obs_frontend_get_main_window(void)
+{
+	return nullptr;
+}
+
+void obs_frontend_get_scenes(struct obs_frontend_source_list *sources)
+{
+	for(const auto &scene : frontend_scenes)
+	{
+		obs_source_t *source = obs_source_get_ref(scene);
+		da_push_back(sources->sources, &source);
+	}
+}
+
+obs_source_t *obs_frontend_get_current_scene(void)
+{
+	return nullptr;
+}
+
+void obs_frontend_set_current_scene(obs_source_t */*scene*/)
+{}
+
+obs_source_t *obs_frontend_get_current_preview_scene(void)
+{
+	return nullptr;
+}
+
+void obs_frontend_set_current_preview_scene(obs_source_t */*scene*/)
+{}
+
+bool obs_frontend_preview_program_mode_active(void)
+{
+	return false;
+}
+
+config_t *obs_frontend_get_profile_config(void)
+{
+	return frontend_config;
+}
+
+config_t *obs_frontend_get_user_config(void)
+{
+	return frontend_config;
+}
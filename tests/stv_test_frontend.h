@@ -0,0 +1,17 @@
+#ifndef STV_TEST_FRONTEND_H
+#define STV_TEST_FRONTEND_H
+
+#include <obs.hpp>
+
+#include <vector>
+
+
+// Tests run the model without OBS' frontend. The frontend functions the model uses are provided by the tests,
+// obs_frontend_get_scenes() returns the scenes set here
+void SetFrontendScenes(const std::vector<OBSSource> &scenes);
+
+// Starts libobs without modules, and shuts it down once the frontend's scenes were released
+bool StartTestObs();
+void StopTestObs();
+
+#endif //STV_TEST_FRONTEND_H
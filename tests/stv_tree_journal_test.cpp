@@ -0,0 +1,152 @@
+#include "stv_test_frontend.h"
+
+#include "obs_scene_tree_view/stv_item_model.h"
+#include "obs_scene_tree_view/stv_tree_storage.h"
+
+#include <QCoreApplication>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+static constexpr const char *SCENE_COLLECTION = "Test Collection";
+
+// Names of all items in display order, items of folders are prefixed with the folder names
+static void ReadTreeOrder(StvItemModel &model, const QModelIndex &parent, const std::string &prefix, std::vector<std::string> &items)
+{
+	if(model.canFetchMore(parent))
+		model.fetchMore(parent);
+
+	for(int row = 0; row < model.rowCount(parent); ++row)
+	{
+		const QModelIndex index = model.index(row, 0, parent);
+		const std::string name = prefix + model.data(index).toString().toStdString();
+		items.push_back(name);
+
+		if(model.IsFolder(index))
+			ReadTreeOrder(model, index, name + "/", items);
+	}
+}
+
+static std::vector<std::string> ReadTreeOrder(StvItemModel &model)
+{
+	std::vector<std::string> items;
+	ReadTreeOrder(model, QModelIndex(), std::string(), items);
+	return items;
+}
+
+// Loads the tree the same way ObsSceneTreeView::LoadSceneTree() does with the journal enabled
+static void LoadTree(StvTreeStorage &tree_storage, StvItemModel &model)
+{
+	OBSDataAutoRelease stv_data = tree_storage.LoadTree(SCENE_COLLECTION);
+	model.LoadSceneTree(stv_data, SCENE_COLLECTION);
+
+	if(model.IsTreeOutdated() || !tree_storage.ContinueJournal(SCENE_COLLECTION))
+	{
+		StvTreeSnapshot snapshot;
+		model.CaptureSceneTree(snapshot);
+		tree_storage.SaveTree(SCENE_COLLECTION, std::move(snapshot));
+	}
+}
+
+static bool CheckTreeOrder(const char *check, const std::vector<std::string> &items, const std::vector<std::string> &expected_items)
+{
+	if(items == expected_items)
+		return true;
+
+	std::fprintf(stderr, "%s: tree order differs\n", check);
+	for(size_t i = 0; i < std::max(items.size(), expected_items.size()); ++i)
+	{
+		std::fprintf(stderr, "  %-24s %s\n", i < items.size() ? items[i].c_str() : "-",
+		             i < expected_items.size() ? expected_items[i].c_str() : "-");
+	}
+
+	return false;
+}
+
+// Edits of a tree whose saved file still contains a scene that doesn't exist anymore must be replayed at the rows
+// they were made at
+static bool TestJournalWithMissingScene(const std::string &tree_dir)
+{
+	OBSSceneAutoRelease scene_a = obs_scene_create("Scene A");
+	OBSSceneAutoRelease scene_b = obs_scene_create("Scene B");
+	OBSSceneAutoRelease scene_c = obs_scene_create("Scene C");
+
+	const OBSSource source_a = obs_scene_get_source(scene_a);
+	const OBSSource source_b = obs_scene_get_source(scene_b);
+	const OBSSource source_c = obs_scene_get_source(scene_c);
+	SetFrontendScenes({source_a, source_b, source_c});
+
+	std::vector<std::string> expected_items;
+
+	{
+		StvTreeStorage tree_storage;
+		tree_storage.Open(tree_dir.c_str());
+		tree_storage.SetJournalEnabled(true);
+
+		// The first saved scene was removed while the collection wasn't loaded
+		StvTreeSnapshot snapshot;
+		snapshot.AddScene("Missing Scene", "00000000-0000-0000-0000-000000000000", 1);
+		snapshot.AddScene("Scene A", obs_source_get_uuid(source_a), 2);
+		snapshot.BeginFolder("Folder", 3, true);
+		snapshot.AddScene("Scene B", obs_source_get_uuid(source_b), 4);
+		snapshot.EndFolder();
+		snapshot.AddScene("Scene C", obs_source_get_uuid(source_c), 5);
+		tree_storage.SaveTree(SCENE_COLLECTION, std::move(snapshot));
+		tree_storage.WaitForWrites();
+
+		StvItemModel model;
+		model.SetRecordEdits(true);
+		QObject::connect(&model, &StvItemModel::TreeEdited, [&tree_storage](const OBSData &operation) {
+			tree_storage.AppendJournal(SCENE_COLLECTION, operation);
+		});
+
+		LoadTree(tree_storage, model);
+
+		if(!CheckTreeOrder("Loaded tree", ReadTreeOrder(model), {"Scene A", "Folder", "Folder/Scene B", "Scene C"}))
+			return false;
+
+		// Create a folder between the scenes, then move items in front of it and into the folders:
+		// Scene C, New Folder, New Folder/Folder, New Folder/Folder/Scene B, New Folder/Folder/Scene A
+		model.InsertFolder(QModelIndex(), 1, "New Folder");
+		model.moveRows(QModelIndex(), 3, 1, QModelIndex(), 0);
+		model.moveRows(QModelIndex(), 1, 1, model.index(3, 0), 1);
+		model.moveRows(QModelIndex(), 2, 1, model.index(1, 0), 0);
+
+		expected_items = ReadTreeOrder(model);
+		tree_storage.WaitForWrites();
+	}
+
+	// Load the tree again, with the journaled edits applied to the saved file
+	StvTreeStorage tree_storage;
+	tree_storage.Open(tree_dir.c_str());
+	tree_storage.SetJournalEnabled(true);
+
+	StvItemModel model;
+	LoadTree(tree_storage, model);
+	tree_storage.WaitForWrites();
+
+	return CheckTreeOrder("Reloaded tree", ReadTreeOrder(model), expected_items);
+}
+
+int main(int argc, char **argv)
+{
+	QCoreApplication app(argc, argv);
+
+	QTemporaryDir tree_dir;
+	if(!tree_dir.isValid() || !StartTestObs())
+	{
+		std::fprintf(stderr, "Failed to set up the test\n");
+		return 1;
+	}
+
+	const bool passed = TestJournalWithMissingScene(tree_dir.path().toStdString());
+
+	StopTestObs();
+
+	std::printf("%s\n", passed ? "All tests passed" : "Tests failed");
+	return passed ? 0 : 1;
+}